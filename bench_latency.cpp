@@ -0,0 +1,225 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "busy_poll.h"
+#include "common.h"
+#include "tcp_protocol.h"
+#include "utils.h"
+
+#define BENCH_TOPIC "bench/latency"
+#define BENCH_TIMEOUT_NS (1000ULL * 1000 * 1000)
+
+// Wait until the socket is readable, spinning in busy mode
+bool wait_readable(int sockfd, bool busy) {
+    struct pollfd pfd = {.fd = sockfd, .events = POLLIN, .revents = 0};
+    if (!busy) {
+        return poll(&pfd, 1, BENCH_TIMEOUT_NS / 1000000) > 0;
+    }
+
+    // Non-blocking receives run the kernel busy loop of the socket
+    uint64_t deadline_ns = monotonic_ns() + BENCH_TIMEOUT_NS;
+    while (monotonic_ns() < deadline_ns) {
+        char byte;
+        if (recv(sockfd, &byte, sizeof(byte), MSG_PEEK | MSG_DONTWAIT) >= 0 ||
+            (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            return true;  // Data, end of stream or error, left to the caller
+        }
+    }
+    return false;
+}
+
+void send_ping(int sockfd_udp,
+               const struct sockaddr_in& server_addr,
+               uint32_t seq) {
+    char buffer[51 + 16];
+    memset(buffer, 0, sizeof(buffer));
+    strcpy(buffer, BENCH_TOPIC);
+    buffer[50] = 3;  // STRING
+    int content_len = snprintf(buffer + 51, 16, "%u", seq);
+
+    ssize_t rc = sendto(sockfd_udp, buffer, 51 + content_len, 0,
+                        (struct sockaddr*)&server_addr, sizeof(server_addr));
+    DIE(rc < 0, "sendto failed");
+}
+
+// Read one forwarded message, returns the sequence number it carries
+bool recv_pong(int sockfd_tcp, uint32_t& seq) {
+    MsgUDPForward msg_udp_forward;
+    if (recv_all(sockfd_tcp, &msg_udp_forward, sizeof(msg_udp_forward)) <=
+        0) {
+        return false;
+    }
+
+    uint16_t topic_len = ntohs(msg_udp_forward.topic_len);
+    uint16_t content_len = ntohs(msg_udp_forward.content_len);
+    std::vector<char> payload(topic_len + content_len + 1, '\0');
+    if (recv_all(sockfd_tcp, payload.data(), topic_len + content_len) <= 0) {
+        return false;
+    }
+
+    seq = strtoul(payload.data() + topic_len, nullptr, 10);
+    return true;
+}
+
+void usage(const char* program) {
+    std::cerr << "Usage: " << program << " <IP> <PORT> [--count <N>]"
+              << " [--interval-us <US>] [--busy-poll <CPU>]" << std::endl;
+    exit(EXIT_FAILURE);
+}
+
+// Usage: ./bench_latency <IP> <PORT> [--count <N>] [--interval-us <US>]
+//                        [--busy-poll <CPU>]
+// Measures the time from sending a UDP message to the server until it is
+// forwarded back over TCP, one message in flight at a time. The interval
+// between messages lets the server go idle, which is where blocking and
+// busy-polling event loops differ.
+int main(int argc, char* argv[]) {
+    setvbuf(stdout, NULL, _IONBF, BUFSIZ);
+
+    if (argc < 3 || argc % 2 != 1) {
+        usage(argv[0]);
+    }
+
+    uint32_t count = 10000;
+    uint32_t interval_us = 500;
+    int busy_poll_cpu = -1;
+    for (int i = 3; i < argc; i += 2) {
+        if (strcmp(argv[i], "--count") == 0) {
+            count = strtoul(argv[i + 1], nullptr, 10);
+        } else if (strcmp(argv[i], "--interval-us") == 0) {
+            interval_us = strtoul(argv[i + 1], nullptr, 10);
+        } else if (strcmp(argv[i], "--busy-poll") == 0) {
+            busy_poll_cpu = atoi(argv[i + 1]);
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    uint16_t PORT;
+    int rc = sscanf(argv[2], "%hu", &PORT);
+    DIE(rc != 1, "Given port is invalid");
+
+    struct sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = inet_addr(argv[1]);
+    server_addr.sin_port = htons(PORT);
+
+    int sockfd_udp = socket(AF_INET, SOCK_DGRAM, 0);
+    DIE(sockfd_udp < 0, "socket UDP creation failed");
+    int sockfd_tcp = socket(AF_INET, SOCK_STREAM, 0);
+    DIE(sockfd_tcp < 0, "socket TCP creation failed");
+
+    int enable = 1;
+    DIE(setsockopt(sockfd_tcp, IPPROTO_TCP, TCP_NODELAY, (char*)&enable,
+                   sizeof(int)) < 0,
+        "setsockopt TCP_NODELAY failed");
+
+    bool busy_poll = busy_poll_cpu >= 0;
+    if (busy_poll) {
+        DIE(!pin_to_cpu(busy_poll_cpu), "sched_setaffinity failed");
+        enable_socket_busy_poll(sockfd_tcp);
+    }
+
+    DIE(connect(sockfd_tcp, (struct sockaddr*)&server_addr,
+                sizeof(server_addr)) < 0,
+        "TCP connection failed");
+
+    // Client ID and subscription, in one write
+    MsgClientID msg_client_id;
+    msg_client_id.header.len = htonl(sizeof(msg_client_id));
+    msg_client_id.header.type = MSG_TYPE_CLIENT_ID;
+    memset(msg_client_id.id, 0, sizeof(msg_client_id.id));
+    std::string client_id = "bench" + std::to_string(getpid() % 100000);
+    memcpy(msg_client_id.id, client_id.c_str(), client_id.size());
+
+    std::string topic = BENCH_TOPIC;
+    MsgSubscription msg_subscription;
+    msg_subscription.header.len =
+        htonl(sizeof(msg_subscription) + topic.size());
+    msg_subscription.header.type = MSG_TYPE_SUBSCRIBE;
+    msg_subscription.topic_len = htons(topic.size());
+    msg_subscription.filter_len = 0;
+
+    std::vector<char> send_buf(sizeof(msg_client_id) +
+                               sizeof(msg_subscription) + topic.size());
+    memcpy(send_buf.data(), &msg_client_id, sizeof(msg_client_id));
+    memcpy(send_buf.data() + sizeof(msg_client_id), &msg_subscription,
+           sizeof(msg_subscription));
+    memcpy(send_buf.data() + sizeof(msg_client_id) + sizeof(msg_subscription),
+           topic.c_str(), topic.size());
+    DIE(send_all(sockfd_tcp, send_buf.data(), send_buf.size()) < 0,
+        "Failed to send subscription");
+
+    // Warm up until the subscription is active
+    uint32_t seq = 0;
+    bool ready = false;
+    for (int attempt = 0; attempt < 100 && !ready; attempt++) {
+        send_ping(sockfd_udp, server_addr, ++seq);
+        ready = wait_readable(sockfd_tcp, false);
+    }
+    DIE(!ready, "Server does not forward the benchmark topic");
+    uint32_t received;
+    while (wait_readable(sockfd_tcp, false) &&
+           recv_pong(sockfd_tcp, received) && received != seq) {
+    }
+
+    std::vector<uint64_t> latencies;
+    latencies.reserve(count);
+    uint32_t lost = 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (interval_us > 0) {
+            struct timespec ts = {.tv_sec = interval_us / 1000000,
+                                  .tv_nsec = (interval_us % 1000000) * 1000};
+            nanosleep(&ts, NULL);
+        }
+
+        uint64_t start_ns = monotonic_ns();
+        send_ping(sockfd_udp, server_addr, ++seq);
+
+        // Stale replies of lost pings are skipped
+        bool got_reply = false;
+        while (!got_reply && wait_readable(sockfd_tcp, busy_poll)) {
+            DIE(!recv_pong(sockfd_tcp, received), "Server disconnected");
+            got_reply = received == seq;
+        }
+
+        if (got_reply) {
+            latencies.push_back(monotonic_ns() - start_ns);
+        } else {
+            lost++;
+        }
+    }
+
+    close(sockfd_tcp);
+    close(sockfd_udp);
+
+    if (latencies.empty()) {
+        std::cout << "No replies received." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile_us = [&latencies](double p) {
+        size_t index = std::min(latencies.size() - 1,
+                                static_cast<size_t>(latencies.size() * p));
+        return latencies[index] / 1000.0;
+    };
+
+    std::cout << "messages " << latencies.size() << ", lost " << lost
+              << ", p50 " << percentile_us(0.50) << "us, p90 "
+              << percentile_us(0.90) << "us, p99 " << percentile_us(0.99)
+              << "us, p99.9 " << percentile_us(0.999) << "us, max "
+              << latencies.back() / 1000.0 << "us" << std::endl;
+    return 0;
+}
@@ -0,0 +1,42 @@
+#!/bin/bash
+# Compare the forwarding latency of the default (blocking poll) event loop
+# with the busy-polling one.
+#
+# Usage: ./bench_latency.sh [PORT] [SERVER_CPU] [BENCH_CPU] [COUNT]
+
+PORT=${1:-12399}
+SERVER_CPU=${2:-0}
+BENCH_CPU=${3:-1}
+COUNT=${4:-10000}
+
+make -s server bench_latency || exit 1
+
+run() {
+    local mode=$1
+    shift
+
+    # The server reads commands from stdin, keep it open until we are done
+    local fifo
+    fifo=$(mktemp -u)
+    mkfifo "$fifo"
+    ./server "$PORT" "$@" < "$fifo" > /dev/null &
+    local server_pid=$!
+    exec 3> "$fifo"
+    sleep 0.5
+
+    echo -n "$mode: "
+    if [ "$mode" = "busy-poll" ]; then
+        ./bench_latency 127.0.0.1 "$PORT" --count "$COUNT" \
+            --busy-poll "$BENCH_CPU"
+    else
+        ./bench_latency 127.0.0.1 "$PORT" --count "$COUNT"
+    fi
+
+    echo exit >&3
+    exec 3>&-
+    wait $server_pid
+    rm -f "$fifo"
+}
+
+run default
+run busy-poll --busy-poll "$SERVER_CPU"
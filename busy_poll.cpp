@@ -0,0 +1,47 @@
+#include "busy_poll.h"
+#include <sched.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include "common.h"
+
+bool pin_to_cpu(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+void enable_socket_busy_poll(int sockfd) {
+    int busy_poll_us = SOCKET_BUSY_POLL_US;
+    setsockopt(sockfd, SOL_SOCKET, SO_BUSY_POLL, &busy_poll_us,
+               sizeof(busy_poll_us));
+}
+
+int AdaptivePoller::wait(struct pollfd* fds, nfds_t nfds, int timeout_ms) {
+    if (!busy) {
+        return poll(fds, nfds, timeout_ms);
+    }
+
+    uint64_t deadline_ns = monotonic_ns() + spin_budget_ns;
+    do {
+        // A receive on an empty queue runs the kernel busy loop of the socket,
+        // the data itself is left in place and reported by poll()
+        for (int sockfd : spin_sockets) {
+            char byte;
+            recv(sockfd, &byte, sizeof(byte), MSG_PEEK | MSG_DONTWAIT);
+        }
+
+        int rc = poll(fds, nfds, 0);
+        if (rc != 0) {
+            if (rc > 0) {
+                spin_budget_ns = std::min<uint64_t>(spin_budget_ns * 2,
+                                                    MAX_SPIN_NS);
+            }
+            return rc;
+        }
+    } while (monotonic_ns() < deadline_ns);
+
+    // Nothing arrived while spinning, back off to a blocking wait
+    spin_budget_ns = std::max<uint64_t>(spin_budget_ns / 2, MIN_SPIN_NS);
+    return poll(fds, nfds, timeout_ms);
+}
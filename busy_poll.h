@@ -0,0 +1,40 @@
+#pragma once
+
+#include <poll.h>
+#include <cstdint>
+#include <vector>
+
+// Microseconds the kernel busy-polls the device queue on a receive
+#define SOCKET_BUSY_POLL_US 50
+// Bounds of the time spent spinning before falling back to a blocking wait
+#define MIN_SPIN_NS (20 * 1000)
+#define MAX_SPIN_NS (2 * 1000 * 1000)
+
+// Pin the calling thread to a CPU, returns false on failure
+bool pin_to_cpu(int cpu);
+
+// Enable SO_BUSY_POLL on a socket. It only applies to receive calls on that
+// socket, poll() busy-polls only if the net.core.busy_poll sysctl is set.
+// Failures are ignored: raising SO_BUSY_POLL may need CAP_NET_ADMIN, and the
+// mode still works without it, only spinning in user space.
+void enable_socket_busy_poll(int sockfd);
+
+// Drop-in replacement for poll(fds, nfds, timeout). In busy mode it first spins
+// on non-blocking MSG_PEEK receives of the spin sockets, which make the kernel
+// busy-poll their device queue, and on poll() with a zero timeout. The spin
+// budget doubles when spinning finds events and halves when it runs out and
+// has to block, so an idle loop backs off to a plain blocking wait while a
+// busy one never sleeps.
+class AdaptivePoller {
+   public:
+    explicit AdaptivePoller(bool busy) : busy(busy) {}
+
+    // Latency-critical socket, with SO_BUSY_POLL enabled, to receive from
+    void add_spin_socket(int sockfd) { spin_sockets.push_back(sockfd); }
+    int wait(struct pollfd* fds, nfds_t nfds, int timeout_ms = -1);
+
+   private:
+    bool busy;
+    uint64_t spin_budget_ns = MAX_SPIN_NS;
+    std::vector<int> spin_sockets;
+};
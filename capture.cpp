@@ -0,0 +1,180 @@
+#include "capture.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <chrono>
+
+// Size of the in-memory buffer, and fill level that wakes the writer early
+#define CAPTURE_BUFFER_SIZE (8 * 1024 * 1024)
+#define CAPTURE_FLUSH_THRESHOLD (256 * 1024)
+// Maximum time a record stays in memory when traffic is low
+#define CAPTURE_FLUSH_INTERVAL_MS 100
+
+static bool write_fully(int fd, const char* buffer, size_t len) {
+    while (len > 0) {
+        ssize_t rc = write(fd, buffer, len);
+        if (rc < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        buffer += rc;
+        len -= rc;
+    }
+    return true;
+}
+
+CaptureWriter::~CaptureWriter() {
+    close();
+}
+
+bool CaptureWriter::open(const std::string& path) {
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+
+    CaptureFileHeader header;
+    memcpy(header.magic, CAPTURE_MAGIC, sizeof(header.magic));
+    header.version = CAPTURE_VERSION;
+    if (!write_fully(fd, reinterpret_cast<const char*>(&header),
+                     sizeof(header))) {
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+
+    active.reserve(CAPTURE_BUFFER_SIZE);
+    flushing.reserve(CAPTURE_BUFFER_SIZE);
+    stopping = false;
+    writer = std::thread(&CaptureWriter::writer_loop, this);
+    return true;
+}
+
+void CaptureWriter::record(const char* data,
+                           size_t len,
+                           const struct sockaddr_in& sender) {
+    CaptureRecord record;
+    record.timestamp_ns = monotonic_ns();
+    record.sender_ip = sender.sin_addr.s_addr;
+    record.sender_port = sender.sin_port;
+    record.len = len;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (active.size() + sizeof(record) + len > CAPTURE_BUFFER_SIZE) {
+        dropped_records++;
+        return;
+    }
+    recorded_records++;
+
+    size_t prev_size = active.size();
+    active.resize(prev_size + sizeof(record) + len);
+    memcpy(active.data() + prev_size, &record, sizeof(record));
+    memcpy(active.data() + prev_size + sizeof(record), data, len);
+
+    // Only wake the writer when crossing the threshold, not for every record
+    if (prev_size < CAPTURE_FLUSH_THRESHOLD &&
+        active.size() >= CAPTURE_FLUSH_THRESHOLD) {
+        cv.notify_one();
+    }
+}
+
+void CaptureWriter::writer_loop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        cv.wait_for(lock, std::chrono::milliseconds(CAPTURE_FLUSH_INTERVAL_MS),
+                    [this] {
+                        return stopping ||
+                               active.size() >= CAPTURE_FLUSH_THRESHOLD;
+                    });
+
+        active.swap(flushing);
+        bool done = stopping;
+
+        // Write without holding the lock, record() keeps filling `active`
+        lock.unlock();
+        if (!flushing.empty()) {
+            if (!write_fully(fd, flushing.data(), flushing.size())) {
+                lost_write_bytes += flushing.size();
+            }
+            flushing.clear();
+        }
+        lock.lock();
+
+        if (done && active.empty()) {
+            break;
+        }
+    }
+}
+
+void CaptureWriter::close() {
+    if (fd < 0) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    cv.notify_one();
+    writer.join();
+
+    ::close(fd);
+    fd = -1;
+}
+
+CaptureReader::~CaptureReader() {
+    if (map != nullptr) {
+        munmap(const_cast<char*>(map), map_len);
+    }
+}
+
+bool CaptureReader::open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 ||
+        static_cast<size_t>(st.st_size) < sizeof(CaptureFileHeader)) {
+        ::close(fd);
+        return false;
+    }
+
+    map_len = st.st_size;
+    void* addr = mmap(nullptr, map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+    map = static_cast<const char*>(addr);
+    madvise(addr, map_len, MADV_SEQUENTIAL);
+
+    CaptureFileHeader header;
+    memcpy(&header, map, sizeof(header));
+    if (memcmp(header.magic, CAPTURE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != CAPTURE_VERSION) {
+        return false;
+    }
+    offset = sizeof(header);
+    return true;
+}
+
+bool CaptureReader::next(CaptureRecord& record, const char*& data) {
+    if (map_len - offset < sizeof(record)) {
+        return false;
+    }
+    memcpy(&record, map + offset, sizeof(record));
+    if (map_len - offset - sizeof(record) < record.len) {
+        return false;
+    }
+
+    data = map + offset + sizeof(record);
+    offset += sizeof(record) + record.len;
+    return true;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <netinet/in.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "common.h"
+
+#define CAPTURE_MAGIC "PCOMCAP1"
+#define CAPTURE_VERSION 1
+
+// Capture files are written in host byte order, except for the sender
+// address which is kept in network byte order as received.
+#pragma pack(push, 1)
+
+struct CaptureFileHeader {
+    char magic[8];     // CAPTURE_MAGIC, not null-terminated
+    uint32_t version;  // CAPTURE_VERSION
+};
+
+struct CaptureRecord {
+    uint64_t timestamp_ns;  // CLOCK_MONOTONIC time of reception
+    uint32_t sender_ip;     // IP address in network byte order
+    uint16_t sender_port;   // Port in network byte order
+    uint16_t len;           // Length of the datagram that follows
+};
+
+#pragma pack(pop)
+
+// Streams received datagrams to a capture file. record() only appends to an
+// in-memory buffer; a background thread swaps it out and writes it, so the
+// event loop never waits for the disk. If the writer falls behind and the
+// buffer is full, records are dropped and counted instead; failed writes are
+// counted too, so an incomplete capture is always reported.
+class CaptureWriter {
+   public:
+    ~CaptureWriter();
+
+    bool open(const std::string& path);
+    void record(const char* data,
+                size_t len,
+                const struct sockaddr_in& sender);
+    void close();  // Flushes everything and stops the writer thread
+
+    bool is_open() const { return fd >= 0; }
+    uint64_t recorded() const { return recorded_records; }
+    uint64_t dropped() const { return dropped_records; }
+    uint64_t lost_bytes() const { return lost_write_bytes; }
+
+   private:
+    void writer_loop();
+
+    int fd = -1;
+    std::vector<char> active;    // Filled by record()
+    std::vector<char> flushing;  // Written by the writer thread
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::thread writer;
+    bool stopping = false;
+    // Only updated by the event loop thread
+    uint64_t recorded_records = 0;
+    uint64_t dropped_records = 0;
+    // Bytes the writer thread failed to write
+    std::atomic<uint64_t> lost_write_bytes{0};
+};
+
+// Reads a capture file mapped in memory
+class CaptureReader {
+   public:
+    ~CaptureReader();
+
+    bool open(const std::string& path);
+    // Returns false at the end of the file or on a truncated record
+    bool next(CaptureRecord& record, const char*& data);
+
+   private:
+    const char* map = nullptr;
+    size_t map_len = 0;
+    size_t offset = 0;
+};
@@ -1,9 +1,17 @@
 #pragma once
 
-#include <set>
+#include <map>
 #include <string>
+#include <vector>
+#include "content_filter.h"
+#include "outbound.h"
+
+// Subscribed topic patterns, each with its compiled content filter
+using SubscriptionMap = std::map<std::string, ContentFilter>;
 
 struct Client {
     std::string id;
-    std::set<std::string> subscriptions;
-};
\ No newline at end of file
+    SubscriptionMap subscriptions;
+    OutboundQueue outbound;  // Messages not yet accepted by the socket
+    std::vector<char> inbox;  // Received bytes of incomplete messages
+};
@@ -1,5 +1,12 @@
 
 #include "common.h"
+#include <time.h>
+
+uint64_t monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
 
 bool format_udp_content(
     uint8_t data_type,           // Data type (0-3)
@@ -91,4 +98,63 @@ bool format_udp_content(
             //           << static_cast<int>(data_type) << "\n";
             return false;
     }
-}
\ No newline at end of file
+}
+
+bool decode_udp_value(
+    uint8_t data_type,    // Data type (0-3)
+    const char* content,  // Raw content bytes
+    size_t content_len,   // Content length
+    UdpValue& out)        // Output: Decoded value
+{
+    out.numeric = data_type != 3;
+    out.number = 0;
+    out.str = nullptr;
+    out.str_len = 0;
+
+    switch (data_type) {
+        case 0: {  // INT
+            if (content_len < 5) {
+                return false;
+            }
+            uint32_t num_net;
+            memcpy(&num_net, content + 1, sizeof(num_net));
+            out.number = static_cast<double>(ntohl(num_net));
+            if (content[0] == 1) {
+                out.number = -out.number;
+            }
+            return true;
+        }
+        case 1: {  // SHORT_REAL
+            if (content_len < 2) {
+                return false;
+            }
+            uint16_t num_net;
+            memcpy(&num_net, content, sizeof(num_net));
+            out.number = static_cast<double>(ntohs(num_net)) / 100.0;
+            return true;
+        }
+        case 2: {  // FLOAT
+            if (content_len < 6) {
+                return false;
+            }
+            uint32_t num_net;
+            memcpy(&num_net, content + 1, sizeof(num_net));
+            out.number = static_cast<double>(ntohl(num_net));
+            uint8_t power_neg = static_cast<uint8_t>(content[5]);
+            if (power_neg > 0) {
+                out.number /= std::pow(10.0, power_neg);
+            }
+            if (content[0] == 1) {
+                out.number = -out.number;
+            }
+            return true;
+        }
+        case 3: {  // STRING
+            out.str = content;
+            out.str_len = strnlen(content, content_len);
+            return true;
+        }
+        default:
+            return false;
+    }
+}
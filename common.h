@@ -1,3 +1,5 @@
+#pragma once
+
 #include <arpa/inet.h>
 #include <math.h>
 #include <string.h>
@@ -5,8 +7,25 @@
 #include <iostream>
 #include <vector>
 
+// Decoded payload value of a UDP datagram
+struct UdpValue {
+    bool numeric;     // true for INT, SHORT_REAL and FLOAT
+    double number;    // Numeric value (valid if numeric)
+    const char* str;  // STRING value, points into the content (not owned)
+    size_t str_len;   // STRING length, without trailing null bytes
+};
+
+// Current CLOCK_MONOTONIC time in nanoseconds
+uint64_t monotonic_ns();
+
 bool format_udp_content(
     uint8_t data_type,            // Data type (0-3)
     std::vector<char>& content,   // Content as a char vector
     std::string& out_type_str,    // Output: Type as string ("INT", etc.)
-    std::string& out_value_str);  // Output: Formatted value as string
\ No newline at end of file
+    std::string& out_value_str);  // Output: Formatted value as string
+
+bool decode_udp_value(
+    uint8_t data_type,    // Data type (0-3)
+    const char* content,  // Raw content bytes
+    size_t content_len,   // Content length
+    UdpValue& out);       // Output: Decoded value
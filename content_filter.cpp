@@ -0,0 +1,108 @@
+#include "content_filter.h"
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+static bool parse_op(const std::string& expr, size_t& pos, FilterOp& op) {
+    static const struct {
+        const char* text;
+        FilterOp op;
+    } ops[] = {
+        // Two-character operators first so "<=" is not read as "<"
+        {"==", FILTER_EQ}, {"!=", FILTER_NE}, {"<=", FILTER_LE},
+        {">=", FILTER_GE}, {"<", FILTER_LT},  {">", FILTER_GT},
+    };
+
+    for (const auto& candidate : ops) {
+        size_t len = strlen(candidate.text);
+        if (expr.compare(pos, len, candidate.text) == 0) {
+            op = candidate.op;
+            pos += len;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool compile_content_filter(const std::string& expr, ContentFilter& out) {
+    out = ContentFilter();
+
+    size_t pos = expr.find_first_not_of(" \t");
+    if (pos == std::string::npos) {
+        return true;  // No filter
+    }
+
+    FilterOp op;
+    if (!parse_op(expr, pos, op)) {
+        return false;
+    }
+
+    pos = expr.find_first_not_of(" \t", pos);
+    if (pos == std::string::npos) {
+        return false;  // Missing operand
+    }
+    size_t end = expr.find_last_not_of(" \t");
+    std::string operand = expr.substr(pos, end - pos + 1);
+
+    // A quoted operand is always a string
+    if (operand.size() >= 2 && operand.front() == '"' &&
+        operand.back() == '"') {
+        out.op = op;
+        out.str = operand.substr(1, operand.size() - 2);
+        return true;
+    }
+
+    char* num_end = nullptr;
+    double number = strtod(operand.c_str(), &num_end);
+    if (num_end != operand.c_str() && *num_end == '\0') {
+        out.op = op;
+        out.numeric = true;
+        out.number = number;
+        return true;
+    }
+
+    out.op = op;
+    out.str = operand;
+    return true;
+}
+
+template <typename T>
+static bool compare(FilterOp op, const T& lhs, const T& rhs) {
+    switch (op) {
+        case FILTER_EQ:
+            return lhs == rhs;
+        case FILTER_NE:
+            return lhs != rhs;
+        case FILTER_LT:
+            return lhs < rhs;
+        case FILTER_LE:
+            return lhs <= rhs;
+        case FILTER_GT:
+            return lhs > rhs;
+        case FILTER_GE:
+            return lhs >= rhs;
+        default:
+            return true;
+    }
+}
+
+bool filter_matches(const ContentFilter& filter, const UdpValue& value) {
+    if (filter.op == FILTER_NONE) {
+        return true;
+    }
+    if (filter.numeric != value.numeric) {
+        return false;
+    }
+    if (filter.numeric) {
+        return compare(filter.op, value.number, filter.number);
+    }
+
+    // Lexicographic comparison without copying the datagram content
+    size_t len = std::min(value.str_len, filter.str.size());
+    int cmp = memcmp(value.str, filter.str.data(), len);
+    if (cmp == 0) {
+        cmp = (value.str_len > filter.str.size()) -
+              (value.str_len < filter.str.size());
+    }
+    return compare(filter.op, cmp, 0);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include "common.h"
+
+enum FilterOp : uint8_t {
+    FILTER_NONE = 0,  // No filter, every message matches
+    FILTER_EQ,        // ==
+    FILTER_NE,        // !=
+    FILTER_LT,        // <
+    FILTER_LE,        // <=
+    FILTER_GT,        // >
+    FILTER_GE,        // >=
+};
+
+// Predicate over the value of a message, compiled once when subscribing.
+// A numeric operand only matches INT, SHORT_REAL and FLOAT messages, a string
+// operand only matches STRING messages.
+struct ContentFilter {
+    FilterOp op = FILTER_NONE;
+    bool numeric = false;
+    double number = 0;
+    std::string str;
+};
+
+// Compile a filter expression such as "> 30", "!= 0" or "== \"on\"".
+// An empty expression compiles to FILTER_NONE.
+bool compile_content_filter(const std::string& expr, ContentFilter& out);
+
+// Evaluate a compiled filter against an already decoded value
+bool filter_matches(const ContentFilter& filter, const UdpValue& value);
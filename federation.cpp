@@ -0,0 +1,68 @@
+#include "federation.h"
+#include <arpa/inet.h>
+#include <string.h>
+#include "tcp_protocol.h"
+
+bool DuplicateFilter::seen(uint32_t origin_id, uint32_t epoch, uint32_t seq) {
+    auto it = windows.find(origin_id);
+    if (it == windows.end() || it->second.epoch != epoch) {
+        // First message from this origin, or the origin restarted
+        windows[origin_id] = {epoch, seq, 1};
+        return false;
+    }
+
+    Window& window = it->second;
+    if (seq > window.highest) {
+        uint32_t shift = seq - window.highest;
+        window.bitmap = (shift >= 64) ? 0 : window.bitmap << shift;
+        window.bitmap |= 1;
+        window.highest = seq;
+        return false;
+    }
+
+    uint32_t offset = window.highest - seq;
+    if (offset >= 64) {
+        // Older than the window within the same run of the origin: only a
+        // lagging second link delivers these, so it was already seen
+        return true;
+    }
+    if (window.bitmap & (1ULL << offset)) {
+        return true;
+    }
+    window.bitmap |= 1ULL << offset;
+    return false;
+}
+
+std::vector<char> encode_interest(const std::set<std::string>& interest) {
+    std::vector<char> body;
+    for (const auto& topic : interest) {
+        uint16_t topic_len = htons(topic.size());
+        const char* len_ptr = reinterpret_cast<const char*>(&topic_len);
+        body.insert(body.end(), len_ptr, len_ptr + sizeof(topic_len));
+        body.insert(body.end(), topic.begin(), topic.end());
+    }
+    return body;
+}
+
+bool decode_interest(const char* body,
+                     size_t body_len,
+                     std::set<std::string>& out) {
+    out.clear();
+    size_t offset = 0;
+    while (offset < body_len) {
+        uint16_t topic_len;
+        if (body_len - offset < sizeof(topic_len)) {
+            return false;
+        }
+        memcpy(&topic_len, body + offset, sizeof(topic_len));
+        topic_len = ntohs(topic_len);
+        offset += sizeof(topic_len);
+
+        if (body_len - offset < topic_len) {
+            return false;
+        }
+        out.emplace(body + offset, topic_len);
+        offset += topic_len;
+    }
+    return true;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <netinet/in.h>
+#include <cstdint>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "outbound.h"
+
+// Back-off between two attempts to reach a peer given with --peer
+#define PEER_RECONNECT_MIN_NS (100ULL * 1000 * 1000)
+#define PEER_RECONNECT_MAX_NS (5ULL * 1000 * 1000 * 1000)
+// Time a connection to a peer may take before it is retried after a back-off
+#define PEER_CONNECT_TIMEOUT_NS (1000ULL * 1000 * 1000)
+// Upper bound for a message sent by a peer, to reject corrupted lengths
+#define MAX_PEER_MESSAGE_LEN (16 * 1024 * 1024)
+
+// Another broker connected over TCP. Brokers form a full mesh: a message is
+// forwarded only by the broker that received it over UDP, so it crosses at
+// most one peer link and can never loop back.
+struct Peer {
+    uint32_t broker_id = 0;          // 0 until the peer's hello is received
+    std::set<std::string> interest;  // Topic patterns the peer subscribes to
+    OutboundQueue outbound;          // Messages not yet accepted by the socket
+    int link = -1;                   // Index in Federation::links, if dialed
+
+    uint64_t forwarded = 0;   // Messages sent to the peer
+    uint64_t received = 0;    // Messages received from the peer
+    uint64_t duplicates = 0;  // Received messages dropped as duplicates
+};
+
+// A peer given with --peer, dialed again with back-off when the link drops
+struct PeerLink {
+    struct sockaddr_in addr;
+    int fd = -1;  // -1 while disconnected
+    bool connecting = false;  // fd is a non-blocking connect in progress
+    uint64_t next_attempt_ns = 0;  // Connect deadline while connecting
+    uint64_t backoff_ns = PEER_RECONNECT_MIN_NS;
+};
+
+// Drops messages that were already delivered, keyed by (origin, sequence).
+// Keeps a sliding window of the last 64 sequence numbers for each origin.
+// The epoch changes every time the origin broker starts, so a restarted
+// origin counting from 1 again gets a fresh window.
+class DuplicateFilter {
+   public:
+    // Returns true if the message was seen before, marks it as seen otherwise
+    bool seen(uint32_t origin_id, uint32_t epoch, uint32_t seq);
+
+   private:
+    struct Window {
+        uint32_t epoch = 0;
+        uint32_t highest = 0;
+        uint64_t bitmap = 0;  // bit i set => (highest - i) was seen
+    };
+    std::unordered_map<uint32_t, Window> windows;
+};
+
+// Serialize / parse the topic list of a MSG_TYPE_PEER_INTEREST frame body
+std::vector<char> encode_interest(const std::set<std::string>& interest);
+bool decode_interest(const char* body,
+                     size_t body_len,
+                     std::set<std::string>& out);
+
+// Federation state of this broker
+struct Federation {
+    uint32_t broker_id = 0;
+    uint32_t epoch = 0;                   // Random, chosen at startup
+    uint32_t next_seq = 0;                // Sequence of the last UDP message
+    std::unordered_map<int, Peer> peers;  // Peers by socket fd
+    std::vector<PeerLink> links;          // Peers given with --peer
+    std::set<std::string> advertised;     // Interest last sent to the peers
+    DuplicateFilter duplicates;
+    LaneStats stats[NUM_LANES];  // Queueing latency of the peer links
+};
@@ -0,0 +1,132 @@
+#include "outbound.h"
+#include <errno.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include "common.h"
+
+void LaneStats::add(uint64_t latency_ns) {
+    count++;
+    total_ns += latency_ns;
+    if (latency_ns > max_ns) {
+        max_ns = latency_ns;
+    }
+
+    int bucket = 0;
+    while (bucket < LATENCY_BUCKETS - 1 && (latency_ns >> (bucket + 1))) {
+        bucket++;
+    }
+    buckets[bucket]++;
+}
+
+uint64_t LaneStats::percentile_ns(double p) const {
+    uint64_t target = static_cast<uint64_t>(count * p);
+    uint64_t seen = 0;
+    for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+        seen += buckets[bucket];
+        if (seen > target) {
+            return std::min<uint64_t>(1ULL << (bucket + 1), max_ns);
+        }
+    }
+    return max_ns;
+}
+
+void OutboundQueue::push(int lane,
+                         std::shared_ptr<const std::vector<char>> data,
+                         LaneStats* stats,
+                         bool droppable) {
+    queued_bytes += data->size();
+    lanes[lane].push_back({std::move(data), 0, monotonic_ns(), droppable});
+
+    while (queued_bytes > OUTBOUND_QUEUE_LIMIT && drop_oldest(stats)) {
+    }
+}
+
+bool OutboundQueue::drop_oldest(LaneStats* stats) {
+    for (int lane = NUM_LANES - 1; lane >= 0; lane--) {
+        std::deque<OutboundMessage>& pending = lanes[lane];
+        // The head of the lane being sent must be finished to keep the framing
+        for (size_t index = lane == in_progress ? 1 : 0; index < pending.size();
+             index++) {
+            if (!pending[index].droppable) {
+                continue;
+            }
+
+            queued_bytes -= pending[index].data->size();
+            pending.erase(pending.begin() + index);
+            stats[lane].dropped++;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool OutboundQueue::empty() const {
+    for (const auto& lane : lanes) {
+        if (!lane.empty()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int OutboundQueue::pick_lane() {
+    // A partially sent message must be finished first to keep the framing
+    if (in_progress >= 0) {
+        return in_progress;
+    }
+
+    // A lower lane that waited too long goes first, the lowest one wins
+    for (int lane = NUM_LANES - 1; lane > 0; lane--) {
+        if (!lanes[lane].empty() && skipped[lane] >= LANE_STARVATION_LIMIT) {
+            return lane;
+        }
+    }
+
+    for (int lane = 0; lane < NUM_LANES; lane++) {
+        if (!lanes[lane].empty()) {
+            return lane;
+        }
+    }
+    return -1;
+}
+
+bool OutboundQueue::flush(int fd, LaneStats* stats) {
+    int lane;
+    while ((lane = pick_lane()) >= 0) {
+        OutboundMessage& msg = lanes[lane].front();
+        const char* buff = msg.data->data() + msg.offset;
+        size_t remaining = msg.data->size() - msg.offset;
+
+        ssize_t rc = send(fd, buff, remaining, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (rc < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;  // Retried when the socket becomes writable
+            }
+            for (auto& pending : lanes) {
+                pending.clear();
+            }
+            queued_bytes = 0;
+            in_progress = -1;
+            return false;
+        }
+
+        msg.offset += rc;
+        if (msg.offset < msg.data->size()) {
+            in_progress = lane;
+            continue;
+        }
+
+        stats[lane].add(monotonic_ns() - msg.enqueued_ns);
+        queued_bytes -= msg.data->size();
+        lanes[lane].pop_front();
+        in_progress = -1;
+
+        skipped[lane] = 0;
+        for (int lower = lane + 1; lower < NUM_LANES; lower++) {
+            if (!lanes[lower].empty()) {
+                skipped[lower]++;
+            }
+        }
+    }
+    return true;
+}
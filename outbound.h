@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#define NUM_LANES 3     // Lane 0 has the highest priority
+#define DEFAULT_LANE 1  // Lane of topics that match no priority rule
+// After this many messages sent from higher lanes while a lower lane was
+// waiting, the lower lane gets to send one message
+#define LANE_STARVATION_LIMIT 16
+#define LATENCY_BUCKETS 40  // Bucket i counts latencies in [2^i, 2^(i+1)) ns
+// Bytes a single client or peer may have queued before messages are dropped
+#define OUTBOUND_QUEUE_LIMIT (4 * 1024 * 1024)
+// Topics whose lane is cached; the cache is cleared when it grows past this
+#define LANE_CACHE_LIMIT 4096
+
+// Queueing latency of a lane, from enqueue to the last byte being accepted
+// by the socket
+struct LaneStats {
+    uint64_t count = 0;
+    uint64_t total_ns = 0;
+    uint64_t max_ns = 0;
+    uint64_t buckets[LATENCY_BUCKETS] = {};
+    uint64_t dropped = 0;  // Messages dropped because a queue was full
+
+    void add(uint64_t latency_ns);
+    uint64_t percentile_ns(double p) const;  // Upper bound of the bucket
+};
+
+// Priority lanes assigned by topic pattern, first matching rule wins
+struct PriorityLanes {
+    std::vector<std::pair<std::string, int>> rules;  // (pattern, lane)
+    std::unordered_map<std::string, int> topic_lanes;  // Cached lookups
+    LaneStats stats[NUM_LANES];
+};
+
+struct OutboundMessage {
+    std::shared_ptr<const std::vector<char>> data;  // Shared by all clients
+    size_t offset;                                  // Bytes already sent
+    uint64_t enqueued_ns;
+    bool droppable;  // False for control messages that must be delivered
+};
+
+// Outbound messages of a client, one FIFO per lane. Higher lanes are always
+// drained first, with LANE_STARVATION_LIMIT protecting the lower ones.
+// When more than OUTBOUND_QUEUE_LIMIT bytes are queued, the oldest messages
+// of the lowest priority lane are dropped first; a partially sent message and
+// the messages pushed as not droppable are never dropped.
+class OutboundQueue {
+   public:
+    void push(int lane, std::shared_ptr<const std::vector<char>> data,
+              LaneStats* stats, bool droppable = true);
+    bool empty() const;
+    size_t bytes() const { return queued_bytes; }
+
+    // Send as much as the socket accepts without blocking. Returns false on
+    // a socket error, in which case the queue is dropped.
+    bool flush(int fd, LaneStats* stats);
+
+   private:
+    int pick_lane();
+    bool drop_oldest(LaneStats* stats);
+
+    std::deque<OutboundMessage> lanes[NUM_LANES];
+    size_t queued_bytes = 0;
+    unsigned skipped[NUM_LANES] = {};  // Messages sent while the lane waited
+    int in_progress = -1;  // Lane of a partially sent message, if any
+};
@@ -0,0 +1,89 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <iostream>
+#include <string>
+#include "capture.h"
+#include "utils.h"
+
+// Sleep until the given CLOCK_MONOTONIC time
+static void sleep_until_ns(uint64_t deadline_ns) {
+    struct timespec ts;
+    ts.tv_sec = deadline_ns / 1000000000ULL;
+    ts.tv_nsec = deadline_ns % 1000000000ULL;
+    // Returns the error instead of setting errno, only a signal is retried
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+           EINTR) {
+    }
+}
+
+// Usage: ./replay <CAPTURE_FILE> <SERVER_IP> <SERVER_PORT> [--speed <FACTOR>]
+// FACTOR scales the original timing (2 = twice as fast), 0 sends as fast as
+// possible. Datagrams are sent from this process' own address, the original
+// senders are only kept in the capture.
+int main(int argc, char* argv[]) {
+    setvbuf(stdout, NULL, _IONBF, BUFSIZ);
+
+    if (argc != 4 && !(argc == 6 && strcmp(argv[4], "--speed") == 0)) {
+        std::cerr << "Usage: " << argv[0]
+                  << " <CAPTURE_FILE> <IP> <PORT> [--speed <FACTOR>]"
+                  << std::endl;
+        exit(EXIT_FAILURE);
+    }
+
+    double speed = 1.0;
+    if (argc == 6) {
+        speed = atof(argv[5]);
+        DIE(speed < 0, "Given speed is invalid");
+    }
+
+    uint16_t PORT;
+    int rc = sscanf(argv[3], "%hu", &PORT);
+    DIE(rc != 1, "Given port is invalid");
+
+    CaptureReader reader;
+    DIE(!reader.open(argv[1]), "Failed to open capture file");
+
+    int sockfd_udp = socket(AF_INET, SOCK_DGRAM, 0);
+    DIE(sockfd_udp < 0, "socket UDP creation failed");
+
+    struct sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = inet_addr(argv[2]);
+    server_addr.sin_port = htons(PORT);
+
+    CaptureRecord record;
+    const char* data;
+    uint64_t first_ts = 0;
+    uint64_t start_ns = monotonic_ns();
+    uint64_t sent = 0;
+
+    while (reader.next(record, data)) {
+        if (sent == 0) {
+            first_ts = record.timestamp_ns;
+        }
+
+        if (speed > 0) {
+            uint64_t offset_ns = record.timestamp_ns - first_ts;
+            sleep_until_ns(start_ns +
+                           static_cast<uint64_t>(offset_ns / speed));
+        }
+
+        ssize_t rc = sendto(sockfd_udp, data, record.len, 0,
+                            (struct sockaddr*)&server_addr,
+                            sizeof(server_addr));
+        DIE(rc < 0, "sendto failed");
+        sent++;
+    }
+
+    double elapsed_s = (monotonic_ns() - start_ns) / 1e9;
+    std::cout << "Replayed " << sent << " datagrams in " << elapsed_s << "s."
+              << std::endl;
+
+    close(sockfd_udp);
+    return 0;
+}
@@ -1,20 +1,99 @@
 #include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <math.h>
 #include <netinet/tcp.h>
 #include <poll.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <unistd.h>
+#include <algorithm>
 #include <iostream>
+#include <random>
 #include <regex>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
 #include "client.h"
 #include "common.h"
+#include "busy_poll.h"
+#include "capture.h"
+#include "content_filter.h"
+#include "federation.h"
 #include "tcp_protocol.h"
 #include "utils.h"
 
+struct ServerConfig {
+    int port = 0;
+    uint32_t broker_id = 0;                // Unique ID within the federation
+    std::vector<struct sockaddr_in> peers;  // Brokers to connect to at startup
+    std::string capture_path;  // Capture file for UDP traffic (empty = off)
+    std::vector<std::pair<std::string, int>> lane_rules;  // (pattern, lane)
+    int busy_poll_cpu = -1;  // CPU of the busy-polling event loop (-1 = off)
+};
+
+// Usage: ./server <PORT> [--id <BROKER_ID>] [--peer <IP>:<PORT>]...
+//                 [--capture <FILE>] [--lane <PATTERN>=<LANE>]...
+//                 [--busy-poll <CPU>]
+bool parse_server_args(int argc, char* argv[], ServerConfig& config) {
+    if (argc < 2) {
+        return false;
+    }
+    config.port = atoi(argv[1]);
+
+    for (int i = 2; i < argc; i++) {
+        std::string option = argv[i];
+        if (i + 1 >= argc) {
+            return false;
+        }
+        std::string value = argv[++i];
+
+        if (option == "--id") {
+            config.broker_id = strtoul(value.c_str(), nullptr, 10);
+        } else if (option == "--peer") {
+            size_t colon = value.rfind(':');
+            if (colon == std::string::npos) {
+                return false;
+            }
+            struct sockaddr_in peer_addr;
+            memset(&peer_addr, 0, sizeof(peer_addr));
+            peer_addr.sin_family = AF_INET;
+            peer_addr.sin_port = htons(atoi(value.c_str() + colon + 1));
+            if (inet_aton(value.substr(0, colon).c_str(),
+                          &peer_addr.sin_addr) == 0) {
+                return false;
+            }
+            config.peers.push_back(peer_addr);
+        } else if (option == "--capture") {
+            config.capture_path = value;
+        } else if (option == "--lane") {
+            size_t equals = value.rfind('=');
+            if (equals == std::string::npos) {
+                return false;
+            }
+            int lane = atoi(value.c_str() + equals + 1);
+            if (lane < 0 || lane >= NUM_LANES) {
+                return false;
+            }
+            config.lane_rules.emplace_back(value.substr(0, equals), lane);
+        } else if (option == "--busy-poll") {
+            config.busy_poll_cpu = atoi(value.c_str());
+            if (config.busy_poll_cpu < 0) {
+                return false;
+            }
+        } else {
+            return false;
+        }
+    }
+
+    if (config.broker_id == 0) {
+        // Unique enough for several instances on the same host
+        config.broker_id = (static_cast<uint32_t>(getpid()) << 16) ^
+                           static_cast<uint32_t>(config.port);
+    }
+    return true;
+}
+
 void initialize_server(int port, int& listenfd_tcp, int& sockfd_udp) {
     listenfd_tcp = socket(AF_INET, SOCK_STREAM, 0);
     DIE(listenfd_tcp < 0, "socket creation failed for TCP");
@@ -53,7 +132,48 @@ void initialize_server(int port, int& listenfd_tcp, int& sockfd_udp) {
     DIE(listen(listenfd_tcp, SOMAXCONN) < 0, "listen failed");
 }
 
-bool handle_stdin_command() {
+void print_lane_stats(const PriorityLanes& lanes) {
+    for (int lane = 0; lane < NUM_LANES; lane++) {
+        const LaneStats& stats = lanes.stats[lane];
+        uint64_t avg_ns = stats.count ? stats.total_ns / stats.count : 0;
+        std::cout << "Lane " << lane << ": " << stats.count << " messages, avg "
+                  << avg_ns / 1000 << "us, p99 <= "
+                  << stats.percentile_ns(0.99) / 1000 << "us, max "
+                  << stats.max_ns / 1000 << "us, " << stats.dropped
+                  << " dropped" << std::endl;
+    }
+}
+
+void print_peer_stats(const Federation& federation) {
+    for (const auto& peer_pair : federation.peers) {
+        const Peer& peer = peer_pair.second;
+        std::cout << "Peer " << peer.broker_id << ": forwarded "
+                  << peer.forwarded << ", received " << peer.received
+                  << ", duplicates " << peer.duplicates << std::endl;
+    }
+
+    uint64_t dropped = 0;
+    for (const LaneStats& stats : federation.stats) {
+        dropped += stats.dropped;
+    }
+    if (dropped > 0) {
+        std::cout << "Peer links: " << dropped
+                  << " messages dropped on full queues" << std::endl;
+    }
+}
+
+void print_capture_stats(const CaptureWriter& capture) {
+    if (!capture.is_open()) {
+        return;
+    }
+    std::cout << "Capture: " << capture.recorded() << " records, "
+              << capture.dropped() << " dropped, " << capture.lost_bytes()
+              << " bytes lost to write errors" << std::endl;
+}
+
+bool handle_stdin_command(const PriorityLanes& lanes,
+                          const Federation& federation,
+                          const CaptureWriter& capture) {
     std::string command;
     if (std::getline(std::cin, command)) {
         if (!command.empty() && command.back() == '\n') {
@@ -62,6 +182,11 @@ bool handle_stdin_command() {
         if (command == "exit") {
             return true;
         }
+        if (command == "stats") {
+            print_lane_stats(lanes);
+            print_peer_stats(federation);
+            print_capture_stats(capture);
+        }
     }
     return false;
 }
@@ -70,15 +195,12 @@ void handle_client_disconnect(
     int clientfd,
     std::unordered_map<int, Client>& clients,
     std::unordered_map<std::string, int>& client_ids,
-    std::unordered_map<std::string, std::unordered_set<std::string>>&
-        client_subscriptions) {
+    std::unordered_map<std::string, SubscriptionMap>& client_subscriptions) {
     std::string client_id = clients[clientfd].id;
     std::cout << "Client " << client_id << " disconnected." << std::endl;
 
     // Save the client's subscriptions before removing from clients map
-    client_subscriptions[client_id] =
-        std::unordered_set<std::string>(clients[clientfd].subscriptions.begin(),
-                                        clients[clientfd].subscriptions.end());
+    client_subscriptions[client_id] = clients[clientfd].subscriptions;
 
     // Remove from client_ids map to allow reconnection with same ID
     client_ids.erase(client_id);
@@ -88,6 +210,76 @@ void handle_client_disconnect(
     close(clientfd);
 }
 
+// Apply a command to the live subscriptions of a client and to the
+// persistent ones, compiling the filter only once
+void apply_subscription(SubscriptionMap& subscriptions,
+                        SubscriptionMap& persistent,
+                        const SubscriptionCommand& cmd) {
+    if (cmd.type == MSG_TYPE_SUBSCRIBE) {
+        // Compile the filter once, it is reused for every message
+        ContentFilter filter;
+        if (compile_content_filter(cmd.filter, filter)) {
+            subscriptions[cmd.topic] = filter;
+            persistent[cmd.topic] = filter;
+        }
+    } else {
+        subscriptions.erase(cmd.topic);
+        persistent.erase(cmd.topic);
+    }
+}
+
+// Read what a client sent without blocking and apply its complete messages,
+// a partial one is kept until the rest arrives. Returns false if the client
+// disconnected or sent an invalid message.
+bool handle_client_data(
+    int clientfd,
+    Client& client,
+    std::unordered_map<std::string, SubscriptionMap>& client_subscriptions) {
+    char buffer[CLIENT_READ_CHUNK];
+    ssize_t rc = recv(clientfd, buffer, sizeof(buffer), MSG_DONTWAIT);
+    if (rc == 0) {
+        return false;
+    }
+    if (rc < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    std::vector<char>& inbox = client.inbox;
+    inbox.insert(inbox.end(), buffer, buffer + rc);
+
+    SubscriptionMap& persistent = client_subscriptions[client.id];
+    std::vector<SubscriptionCommand> commands;
+    size_t offset = 0;
+    while (inbox.size() - offset >= sizeof(TcpHeader)) {
+        TcpHeader header;
+        memcpy(&header, inbox.data() + offset, sizeof(header));
+        uint32_t len = ntohl(header.len);
+        if (len < sizeof(header) || len > MAX_CLIENT_MESSAGE_LEN) {
+            return false;
+        }
+        if (inbox.size() - offset < len) {
+            break;
+        }
+
+        // The whole message is validated before any of it is applied
+        if (!decode_subscriptions(inbox.data() + offset, len, commands)) {
+            return false;
+        }
+        for (const auto& cmd : commands) {
+            apply_subscription(client.subscriptions, persistent, cmd);
+        }
+        offset += len;
+    }
+
+    // Only complete messages are removed, a large partial one is not copied
+    // again on every read. Idle clients keep no buffer.
+    if (offset == inbox.size()) {
+        std::vector<char>().swap(inbox);
+    } else if (offset > 0) {
+        inbox.erase(inbox.begin(), inbox.begin() + offset);
+    }
+    return true;
+}
+
 // Convert a subscription pattern with wildcards to a regex pattern
 std::string subscription_to_regex(const std::string& subscription) {
     std::string regex_pattern = "^";  // Start anchor
@@ -136,6 +328,34 @@ bool topic_matches(const std::string& subscription,
     return std::regex_match(topic, pattern);
 }
 
+// Priority lane of a topic, the first matching rule wins
+int topic_lane(PriorityLanes& lanes,
+               const std::string& topic,
+               std::unordered_map<std::string, std::regex>& regex_cache) {
+    if (lanes.rules.empty()) {
+        return DEFAULT_LANE;
+    }
+
+    auto it = lanes.topic_lanes.find(topic);
+    if (it != lanes.topic_lanes.end()) {
+        return it->second;
+    }
+
+    int lane = DEFAULT_LANE;
+    for (const auto& rule : lanes.rules) {
+        if (topic_matches(rule.first, topic, regex_cache)) {
+            lane = rule.second;
+            break;
+        }
+    }
+    // Topics are chosen by the publishers, so the cache must stay bounded
+    if (lanes.topic_lanes.size() >= LANE_CACHE_LIMIT) {
+        lanes.topic_lanes.clear();
+    }
+    lanes.topic_lanes[topic] = lane;
+    return lane;
+}
+
 void handle_udp_forwarding(
     std::unordered_map<int, Client>& clients,
     std::unordered_map<std::string, int>& client_ids,
@@ -144,20 +364,45 @@ void handle_udp_forwarding(
     const std::vector<char>& content,
     uint32_t sender_ip,
     uint16_t sender_port,
-    std::unordered_map<std::string, std::regex>& regex_cache) {
-    for (const auto& client_pair : clients) {
+    std::unordered_map<std::string, std::regex>& regex_cache,
+    PriorityLanes& lanes) {
+    // The value is decoded lazily, at most once, for all filtering clients
+    UdpValue value;
+    bool value_decoded = false;
+    bool value_valid = false;
+
+    // Built once, for the first receiving client, and shared by all queues
+    std::shared_ptr<std::vector<char>> send_buf;
+    int lane = DEFAULT_LANE;
+
+    for (auto& client_pair : clients) {
         int clientfd = client_pair.first;
-        const Client& client = client_pair.second;
+        Client& client = client_pair.second;
 
         bool should_receive = false;
         for (const auto& subscription : client.subscriptions) {
-            if (topic_matches(subscription, topic, regex_cache)) {
+            if (!topic_matches(subscription.first, topic, regex_cache)) {
+                continue;
+            }
+
+            const ContentFilter& filter = subscription.second;
+            if (filter.op == FILTER_NONE) {
+                should_receive = true;
+                break;
+            }
+
+            if (!value_decoded) {
+                value_valid = decode_udp_value(data_type, content.data(),
+                                               content.size(), value);
+                value_decoded = true;
+            }
+            if (value_valid && filter_matches(filter, value)) {
                 should_receive = true;
                 break;
             }
         }
 
-        if (should_receive) {
+        if (should_receive && !send_buf) {
             MsgUDPForward msg_udp_forward;
             uint32_t struct_size = sizeof(msg_udp_forward);
             uint32_t topic_size = topic.size();
@@ -171,52 +416,508 @@ void handle_udp_forwarding(
             msg_udp_forward.data_type = data_type;
             msg_udp_forward.content_len = htons(content_size);
 
-            std::vector<char> send_buf;
-            send_buf.resize(struct_size + topic_size + content_size);
+            send_buf = std::make_shared<std::vector<char>>(
+                struct_size + topic_size + content_size);
+
+            memcpy(send_buf->data(), &msg_udp_forward, struct_size);
+            memcpy(send_buf->data() + struct_size, topic.c_str(), topic_size);
+            if (content_size > 0) {
+                memcpy(send_buf->data() + struct_size + topic_size,
+                       content.data(), content_size);
+            }
+
+            lane = topic_lane(lanes, topic, regex_cache);
+        }
+
+        if (should_receive) {
+            // Sent right away if the socket has room, else on POLLOUT
+            client.outbound.push(lane, send_buf, lanes.stats);
+            client.outbound.flush(clientfd, lanes.stats);
+        }
+    }
+}
+
+std::shared_ptr<std::vector<char>> make_peer_hello(uint32_t broker_id) {
+    MsgClientID msg_hello;
+    msg_hello.header.len = htonl(sizeof(msg_hello));
+    msg_hello.header.type = MSG_TYPE_PEER_HELLO;
+    memset(msg_hello.id, 0, sizeof(msg_hello.id));
+    snprintf(msg_hello.id, sizeof(msg_hello.id), "%u", broker_id);
+
+    auto send_buf = std::make_shared<std::vector<char>>(sizeof(msg_hello));
+    memcpy(send_buf->data(), &msg_hello, sizeof(msg_hello));
+    return send_buf;
+}
+
+std::shared_ptr<std::vector<char>> make_peer_interest(
+    const std::set<std::string>& interest) {
+    std::vector<char> body = encode_interest(interest);
+
+    TcpHeader header;
+    header.len = htonl(sizeof(header) + body.size());
+    header.type = MSG_TYPE_PEER_INTEREST;
+
+    auto send_buf =
+        std::make_shared<std::vector<char>>(sizeof(header) + body.size());
+    memcpy(send_buf->data(), &header, sizeof(header));
+    if (!body.empty()) {
+        memcpy(send_buf->data() + sizeof(header), body.data(), body.size());
+    }
+    return send_buf;
+}
+
+// Queue a message for a peer and send what the socket accepts right away,
+// the rest goes out on POLLOUT so a slow peer never blocks the event loop.
+// Control messages are never dropped when the queue is full, the peer would
+// otherwise keep a stale view of this broker.
+void send_to_peer(Federation& federation,
+                  int peerfd,
+                  int lane,
+                  std::shared_ptr<const std::vector<char>> send_buf,
+                  bool control = false) {
+    Peer& peer = federation.peers[peerfd];
+    peer.outbound.push(lane, std::move(send_buf), federation.stats,
+                       !control);
+    peer.outbound.flush(peerfd, federation.stats);
+}
+
+// Aggregated subscriptions of the connected clients, without filters: peers
+// only need the topics, content filters are applied by this broker
+std::set<std::string> collect_local_interest(
+    const std::unordered_map<std::string, int>& client_ids,
+    const std::unordered_map<std::string, SubscriptionMap>&
+        client_subscriptions) {
+    std::set<std::string> interest;
+    for (const auto& id_pair : client_ids) {
+        auto it = client_subscriptions.find(id_pair.first);
+        if (it == client_subscriptions.end()) {
+            continue;
+        }
+        for (const auto& subscription : it->second) {
+            interest.insert(subscription.first);
+        }
+    }
+    return interest;
+}
+
+// Register a new peer connection and introduce ourselves
+void add_peer(Federation& federation,
+              int peerfd,
+              const Peer& peer,
+              std::vector<struct pollfd>& pfds,
+              const std::unordered_map<std::string, int>& client_ids,
+              const std::unordered_map<std::string, SubscriptionMap>&
+                  client_subscriptions) {
+    // The advertised interest is not maintained while there are no peers
+    if (federation.peers.empty()) {
+        federation.advertised =
+            collect_local_interest(client_ids, client_subscriptions);
+    }
+    federation.peers[peerfd] = peer;
+    // Control messages use the highest lane, the hello always goes first
+    send_to_peer(federation, peerfd, 0, make_peer_hello(federation.broker_id),
+                 true);
+    send_to_peer(federation, peerfd, 0,
+                 make_peer_interest(federation.advertised), true);
+    pfds.push_back({.fd = peerfd, .events = POLLIN, .revents = 0});
+}
+
+// Start a non-blocking connection to a peer, returns -1 if it failed already
+int start_peer_connect(const struct sockaddr_in& peer_addr) {
+    int peerfd = socket(AF_INET, SOCK_STREAM, 0);
+    DIE(peerfd < 0, "socket creation failed for peer");
+
+    int enable = 1;
+    DIE(setsockopt(peerfd, IPPROTO_TCP, TCP_NODELAY, (char*)&enable,
+                   sizeof(int)) < 0,
+        "setsockopt TCP_NODELAY failed");
+
+    int flags = fcntl(peerfd, F_GETFL, 0);
+    DIE(fcntl(peerfd, F_SETFL, flags | O_NONBLOCK) < 0, "fcntl failed");
+
+    int rc = connect(peerfd, (struct sockaddr*)&peer_addr, sizeof(peer_addr));
+    if (rc < 0 && errno != EINPROGRESS) {
+        close(peerfd);
+        return -1;
+    }
+    return peerfd;
+}
+
+void schedule_peer_retry(PeerLink& link) {
+    link.fd = -1;
+    link.connecting = false;
+    link.next_attempt_ns = monotonic_ns() + link.backoff_ns;
+    link.backoff_ns =
+        std::min<uint64_t>(link.backoff_ns * 2, PEER_RECONNECT_MAX_NS);
+}
+
+// Link whose connection is in progress on a socket, or -1
+int connecting_link(const Federation& federation, int fd) {
+    for (size_t i = 0; i < federation.links.size(); i++) {
+        const PeerLink& link = federation.links[i];
+        if (link.connecting && link.fd == fd) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Complete a connection once poll() reports its socket, the poll entry of
+// the connecting socket must already be removed
+void finish_peer_connect(
+    Federation& federation,
+    int link_index,
+    std::vector<struct pollfd>& pfds,
+    bool busy_poll,
+    const std::unordered_map<std::string, int>& client_ids,
+    const std::unordered_map<std::string, SubscriptionMap>&
+        client_subscriptions) {
+    PeerLink& link = federation.links[link_index];
+    int peerfd = link.fd;
+
+    int error = 0;
+    socklen_t error_len = sizeof(error);
+    if (getsockopt(peerfd, SOL_SOCKET, SO_ERROR, &error, &error_len) < 0 ||
+        error != 0) {
+        close(peerfd);
+        schedule_peer_retry(link);
+        return;
+    }
+
+    // Peer messages are read with recv_all, like client messages
+    int flags = fcntl(peerfd, F_GETFL, 0);
+    DIE(fcntl(peerfd, F_SETFL, flags & ~O_NONBLOCK) < 0, "fcntl failed");
+    if (busy_poll) {
+        enable_socket_busy_poll(peerfd);
+    }
+    link.connecting = false;
+    link.backoff_ns = PEER_RECONNECT_MIN_NS;
+
+    Peer peer;
+    peer.link = link_index;
+    add_peer(federation, peerfd, peer, pfds, client_ids, client_subscriptions);
+}
+
+// Dial the --peer brokers that are due and give up on connections that take
+// too long. Returns the poll timeout (ms) until the next deadline, or -1 if
+// every link is up
+int reconnect_peers(Federation& federation, std::vector<struct pollfd>& pfds) {
+    int timeout_ms = -1;
+    uint64_t now_ns = monotonic_ns();
+
+    for (PeerLink& link : federation.links) {
+        if (link.connecting && link.next_attempt_ns <= now_ns) {
+            for (auto& pfd : pfds) {
+                if (pfd.fd == link.fd) {
+                    pfd.fd = -1;  // Removed at the end of the iteration
+                }
+            }
+            close(link.fd);
+            schedule_peer_retry(link);
+        }
+        if (link.fd >= 0 && !link.connecting) {
+            continue;
+        }
+
+        if (!link.connecting && link.next_attempt_ns <= now_ns) {
+            int peerfd = start_peer_connect(link.addr);
+            if (peerfd >= 0) {
+                link.fd = peerfd;
+                link.connecting = true;
+                link.next_attempt_ns = now_ns + PEER_CONNECT_TIMEOUT_NS;
+                pfds.push_back({.fd = peerfd, .events = POLLOUT, .revents = 0});
+            } else {
+                schedule_peer_retry(link);
+            }
+        }
+
+        int wait_ms = (link.next_attempt_ns - now_ns) / 1000000 + 1;
+        if (timeout_ms < 0 || wait_ms < timeout_ms) {
+            timeout_ms = wait_ms;
+        }
+    }
+    return timeout_ms;
+}
+
+// Send the local interest to every peer if it changed since the last time
+void update_peer_interest(
+    Federation& federation,
+    const std::unordered_map<std::string, int>& client_ids,
+    const std::unordered_map<std::string, SubscriptionMap>&
+        client_subscriptions) {
+    // Without peers, nobody needs the interest; add_peer computes it
+    if (federation.peers.empty()) {
+        return;
+    }
+
+    std::set<std::string> interest =
+        collect_local_interest(client_ids, client_subscriptions);
+    if (interest == federation.advertised) {
+        return;
+    }
+
+    federation.advertised = std::move(interest);
+    auto send_buf = make_peer_interest(federation.advertised);
+    for (const auto& peer_pair : federation.peers) {
+        send_to_peer(federation, peer_pair.first, 0, send_buf, true);
+    }
+}
+
+// Forward a UDP message received by this broker to the interested peers
+void forward_to_peers(
+    Federation& federation,
+    const std::string& topic,
+    uint8_t data_type,
+    const std::vector<char>& content,
+    uint32_t sender_ip,
+    uint16_t sender_port,
+    std::unordered_map<std::string, std::regex>& regex_cache,
+    PriorityLanes& lanes) {
+    if (federation.peers.empty()) {
+        return;
+    }
+
+    uint32_t seq = ++federation.next_seq;
+    std::shared_ptr<std::vector<char>> send_buf;
+    int lane = DEFAULT_LANE;
+
+    for (auto& peer_pair : federation.peers) {
+        Peer& peer = peer_pair.second;
+        if (peer.broker_id == federation.broker_id) {
+            continue;
+        }
+
+        bool interested = false;
+        for (const auto& pattern : peer.interest) {
+            if (topic_matches(pattern, topic, regex_cache)) {
+                interested = true;
+                break;
+            }
+        }
+        if (!interested) {
+            continue;
+        }
 
-            memcpy(send_buf.data(), &msg_udp_forward, struct_size);
-            memcpy(send_buf.data() + struct_size, topic.c_str(), topic_size);
+        // Built once, for the first interested peer
+        if (!send_buf) {
+            MsgPeerForward msg_forward;
+            uint32_t struct_size = sizeof(msg_forward);
+            uint32_t topic_size = topic.size();
+            uint32_t content_size = content.size();
+            msg_forward.header.len =
+                htonl(struct_size + topic_size + content_size);
+            msg_forward.header.type = MSG_TYPE_PEER_FORWARD;
+            msg_forward.origin_id = htonl(federation.broker_id);
+            msg_forward.epoch = htonl(federation.epoch);
+            msg_forward.seq = htonl(seq);
+            msg_forward.sender_ip = sender_ip;
+            msg_forward.sender_port = sender_port;
+            msg_forward.topic_len = htons(topic_size);
+            msg_forward.data_type = data_type;
+            msg_forward.content_len = htons(content_size);
+
+            send_buf = std::make_shared<std::vector<char>>(
+                struct_size + topic_size + content_size);
+            memcpy(send_buf->data(), &msg_forward, struct_size);
+            memcpy(send_buf->data() + struct_size, topic.c_str(), topic_size);
             if (content_size > 0) {
-                memcpy(send_buf.data() + struct_size + topic_size,
+                memcpy(send_buf->data() + struct_size + topic_size,
                        content.data(), content_size);
             }
 
-            send_all(clientfd, send_buf.data(), send_buf.size());
+            lane = topic_lane(lanes, topic, regex_cache);
+        }
+
+        peer.forwarded++;
+        send_to_peer(federation, peer_pair.first, lane, send_buf);
+    }
+}
+
+// Handle one message from a peer broker, returns false if the peer is gone
+bool handle_peer_message(
+    int peerfd,
+    Federation& federation,
+    std::unordered_map<int, Client>& clients,
+    std::unordered_map<std::string, int>& client_ids,
+    std::unordered_map<std::string, std::regex>& regex_cache,
+    PriorityLanes& lanes) {
+    TcpHeader header;
+    if (recv_all(peerfd, &header, sizeof(header)) !=
+        static_cast<int>(sizeof(header))) {
+        return false;
+    }
+
+    uint32_t len = ntohl(header.len);
+    if (len < sizeof(header) || len > MAX_PEER_MESSAGE_LEN) {
+        return false;
+    }
+    std::vector<char> body(len - sizeof(header));
+    if (!body.empty() && recv_all(peerfd, body.data(), body.size()) !=
+                             static_cast<int>(body.size())) {
+        return false;
+    }
+
+    Peer& peer = federation.peers[peerfd];
+
+    switch (header.type) {
+        case MSG_TYPE_PEER_HELLO: {
+            MsgClientID msg_hello;
+            if (body.size() != sizeof(msg_hello) - sizeof(header)) {
+                return false;
+            }
+            memcpy(msg_hello.id, body.data(), sizeof(msg_hello.id));
+            msg_hello.id[sizeof(msg_hello.id) - 1] = '\0';
+            peer.broker_id = strtoul(msg_hello.id, nullptr, 10);
+            if (peer.link >= 0) {
+                std::cout << "Connected to peer broker " << peer.broker_id
+                          << "." << std::endl;
+            }
+            return true;
+        }
+        case MSG_TYPE_PEER_INTEREST:
+            return decode_interest(body.data(), body.size(), peer.interest);
+        case MSG_TYPE_PEER_FORWARD: {
+            MsgPeerForward msg_forward;
+            size_t fields_size = sizeof(msg_forward) - sizeof(header);
+            if (body.size() < fields_size) {
+                return false;
+            }
+            memcpy(reinterpret_cast<char*>(&msg_forward) + sizeof(header),
+                   body.data(), fields_size);
+
+            uint16_t topic_len = ntohs(msg_forward.topic_len);
+            uint16_t content_len = ntohs(msg_forward.content_len);
+            if (body.size() != fields_size + topic_len + content_len) {
+                return false;
+            }
+
+            // Drop our own messages coming back and repeated deliveries
+            peer.received++;
+            uint32_t origin_id = ntohl(msg_forward.origin_id);
+            if (origin_id == federation.broker_id ||
+                federation.duplicates.seen(origin_id,
+                                           ntohl(msg_forward.epoch),
+                                           ntohl(msg_forward.seq))) {
+                peer.duplicates++;
+                return true;
+            }
+
+            const char* topic_ptr = body.data() + fields_size;
+            std::string topic(topic_ptr, topic_len);
+            std::vector<char> content(topic_ptr + topic_len,
+                                      topic_ptr + topic_len + content_len);
+
+            // Delivered locally only, peers got it from the origin broker
+            handle_udp_forwarding(clients, client_ids, topic,
+                                  msg_forward.data_type, content,
+                                  msg_forward.sender_ip,
+                                  msg_forward.sender_port, regex_cache, lanes);
+            return true;
         }
+        default:
+            return false;
+    }
+}
+
+void handle_peer_disconnect(int peerfd, Federation& federation) {
+    const Peer& peer = federation.peers[peerfd];
+    std::cout << "Peer broker " << peer.broker_id << " disconnected."
+              << std::endl;
+
+    // Peers given with --peer are dialed again after the back-off
+    if (peer.link >= 0) {
+        PeerLink& link = federation.links[peer.link];
+        link.fd = -1;
+        link.next_attempt_ns = monotonic_ns() + link.backoff_ns;
     }
+
+    federation.peers.erase(peerfd);
+    close(peerfd);
 }
 
 int main(int argc, char* argv[]) {
     setvbuf(stdout, NULL, _IONBF, BUFSIZ);
 
-    if (argc != 2) {
-        // std::cerr << "Usage: " << argv[0] << " <PORT>" << std::endl;
+    ServerConfig config;
+    if (!parse_server_args(argc, argv, config)) {
+        // std::cerr << "Usage: " << argv[0]
+        //           << " <PORT> [--id <ID>] [--peer <IP>:<PORT>]..."
+        //           << " [--capture <FILE>] [--lane <PATTERN>=<LANE>]..."
+        //           << " [--busy-poll <CPU>]"
+        //           << std::endl;
         exit(EXIT_FAILURE);
     }
-    int PORT = atoi(argv[1]);
+    int PORT = config.port;
 
     int listenfd_tcp, sockfd_udp;
     initialize_server(PORT, listenfd_tcp, sockfd_udp);
 
+    bool busy_poll = config.busy_poll_cpu >= 0;
+    if (busy_poll) {
+        DIE(!pin_to_cpu(config.busy_poll_cpu), "sched_setaffinity failed");
+        enable_socket_busy_poll(sockfd_udp);
+    }
+    AdaptivePoller poller(busy_poll);
+    poller.add_spin_socket(sockfd_udp);
+
     std::vector<struct pollfd> pfds;
     pfds.push_back({.fd = STDIN_FILENO, .events = POLLIN, .revents = 0});
     pfds.push_back({.fd = listenfd_tcp, .events = POLLIN, .revents = 0});
     pfds.push_back({.fd = sockfd_udp, .events = POLLIN, .revents = 0});
 
+    PriorityLanes lanes;
+    lanes.rules = config.lane_rules;
+
+    CaptureWriter capture;
+    if (!config.capture_path.empty()) {
+        DIE(!capture.open(config.capture_path), "capture file open failed");
+    }
+
+    Federation federation;
+    federation.broker_id = config.broker_id;
+    federation.epoch = std::random_device()();
+    for (const auto& peer_addr : config.peers) {
+        PeerLink link;
+        link.addr = peer_addr;
+        federation.links.push_back(link);
+    }
+
     std::unordered_map<int, Client> clients;  // clients by socket fd
     std::unordered_map<std::string, int>
         client_ids;  // map client ID to socket fd
-    std::unordered_map<std::string, std::unordered_set<std::string>>
+    std::unordered_map<std::string, SubscriptionMap>
         client_subscriptions;  // map client ID to subscriptions
 
     std::unordered_map<std::string, std::regex> regex_cache;
 
     while (true) {
-        int poll_result = poll(pfds.data(), pfds.size(), -1);
+        // Set whenever subscriptions may have changed, to re-advertise them
+        bool interest_dirty = false;
+
+        // Wakes up in time for the next attempt to reach a --peer broker
+        int timeout_ms = reconnect_peers(federation, pfds);
+
+        // Wait for writability only on sockets with queued messages
+        for (size_t i = 3; i < pfds.size(); i++) {
+            const OutboundQueue* outbound = nullptr;
+            auto client_it = clients.find(pfds[i].fd);
+            if (client_it != clients.end()) {
+                outbound = &client_it->second.outbound;
+            }
+            auto peer_it = federation.peers.find(pfds[i].fd);
+            if (peer_it != federation.peers.end()) {
+                outbound = &peer_it->second.outbound;
+            }
+            if (outbound != nullptr) {
+                pfds[i].events = outbound->empty() ? POLLIN : POLLIN | POLLOUT;
+            }
+        }
+
+        int poll_result = poller.wait(pfds.data(), pfds.size(), timeout_ms);
         DIE(poll_result < 0, "poll failed");
 
         if (pfds[0].revents & POLLIN) {
-            if (handle_stdin_command()) {
+            if (handle_stdin_command(lanes, federation, capture)) {
                 break;
             }
         }
@@ -233,11 +934,30 @@ int main(int argc, char* argv[]) {
                                     (char*)&enable, sizeof(int));
             DIE(result < 0, "setsockopt TCP_NODELAY failed");
 
+            if (busy_poll) {
+                enable_socket_busy_poll(client_sockfd);
+            }
+
             // Check if the client ID is present
             MsgClientID msg_client_id;
-            DIE(recv_all(client_sockfd, &msg_client_id, sizeof(msg_client_id)) <
-                    0,
-                "recv_all MSG_CLIENT_ID failed");
+            int id_len =
+                recv_all(client_sockfd, &msg_client_id, sizeof(msg_client_id));
+            DIE(id_len < 0, "recv_all MSG_CLIENT_ID failed");
+
+            if (id_len == static_cast<int>(sizeof(msg_client_id)) &&
+                msg_client_id.header.type == MSG_TYPE_PEER_HELLO) {
+                Peer peer;
+                msg_client_id.id[sizeof(msg_client_id.id) - 1] = '\0';
+                peer.broker_id = strtoul(msg_client_id.id, nullptr, 10);
+                add_peer(federation, client_sockfd, peer, pfds, client_ids,
+                         client_subscriptions);
+
+                std::cout << "New peer broker " << peer.broker_id
+                          << " connected from "
+                          << inet_ntoa(client_addr.sin_addr) << ":"
+                          << ntohs(client_addr.sin_port) << "." << std::endl;
+                continue;
+            }
 
             std::string client_id_str = std::string(msg_client_id.id);
 
@@ -257,9 +977,7 @@ int main(int argc, char* argv[]) {
             // Restore subscriptions if this client has connected before
             if (client_subscriptions.find(client_id_str) !=
                 client_subscriptions.end()) {
-                for (const auto& topic : client_subscriptions[client_id_str]) {
-                    client.subscriptions.insert(topic);
-                }
+                client.subscriptions = client_subscriptions[client_id_str];
             }
 
             clients[client_sockfd] = client;
@@ -270,6 +988,7 @@ int main(int argc, char* argv[]) {
             // Add the client socket to the poll list
             pfds.push_back(
                 {.fd = client_sockfd, .events = POLLIN, .revents = 0});
+            interest_dirty = true;
 
             std::cout << "New client " << client.id << " connected from "
                       << inet_ntoa(client_addr.sin_addr) << ":"
@@ -286,6 +1005,10 @@ int main(int argc, char* argv[]) {
                          (struct sockaddr*)&udp_client_addr, &addr_len);
             DIE(bytes_received < 0, "recvfrom failed");
 
+            if (capture.is_open()) {
+                capture.record(buffer, bytes_received, udp_client_addr);
+            }
+
             // Extract topic (first 50 bytes, null-terminated)
             size_t actual_topic_len = strnlen(buffer, 50);
             std::string topic(buffer, actual_topic_len);
@@ -301,68 +1024,71 @@ int main(int argc, char* argv[]) {
             // Forward the UDP message to subscribed clients
             handle_udp_forwarding(clients, client_ids, topic, data_type,
                                   content, udp_client_addr.sin_addr.s_addr,
-                                  udp_client_addr.sin_port, regex_cache);
+                                  udp_client_addr.sin_port, regex_cache,
+                                  lanes);
+            forward_to_peers(federation, topic, data_type, content,
+                             udp_client_addr.sin_addr.s_addr,
+                             udp_client_addr.sin_port, regex_cache, lanes);
         }
 
         for (size_t i = 3; i < pfds.size(); i++) {
-            if (pfds[i].revents & (POLLERR | POLLHUP)) {
-                handle_client_disconnect(pfds[i].fd, clients, client_ids,
-                                         client_subscriptions);
-                pfds[i].fd = -1;  // Mark the fd as closed
+            int link_index = connecting_link(federation, pfds[i].fd);
+            if (link_index >= 0) {
+                if (pfds[i].revents) {
+                    pfds[i].fd = -1;  // add_peer polls the connected socket
+                    finish_peer_connect(federation, link_index, pfds,
+                                        busy_poll, client_ids,
+                                        client_subscriptions);
+                }
                 continue;
             }
 
-            if (pfds[i].revents & POLLIN) {  // Incoming data from client
-                int clientfd = pfds[i].fd;
-                MsgSubscription msg_subscription;
-                ssize_t recv_result = recv_all(clientfd, &msg_subscription,
-                                               sizeof(msg_subscription));
-
-                if (recv_result <= 0) {
-                    handle_client_disconnect(clientfd, clients, client_ids,
-                                             client_subscriptions);
-                    pfds[i].fd = -1;  // Mark the fd as closed
-                    continue;
+            if (pfds[i].fd >= 0 && federation.peers.count(pfds[i].fd)) {
+                if (pfds[i].revents & POLLOUT) {
+                    federation.peers[pfds[i].fd].outbound.flush(
+                        pfds[i].fd, federation.stats);
                 }
-
-                uint16_t topic_len_host = ntohs(msg_subscription.topic_len);
-
-                std::vector<char> topic_buffer(topic_len_host);
-
-                if (recv_all(clientfd, topic_buffer.data(), topic_len_host) <=
-                    0) {
-                    handle_client_disconnect(clientfd, clients, client_ids,
-                                             client_subscriptions);
+                if ((pfds[i].revents & (POLLERR | POLLHUP)) ||
+                    ((pfds[i].revents & POLLIN) &&
+                     !handle_peer_message(pfds[i].fd, federation, clients,
+                                          client_ids, regex_cache, lanes))) {
+                    handle_peer_disconnect(pfds[i].fd, federation);
                     pfds[i].fd = -1;  // Mark the fd as closed
-                    continue;
                 }
+                continue;
+            }
 
-                std::string topic_str(topic_buffer.begin(), topic_buffer.end());
+            if (pfds[i].revents & ~POLLOUT) {
+                interest_dirty = true;
+            }
 
-                if (msg_subscription.header.type == MSG_TYPE_SUBSCRIBE) {
-                    clients[clientfd].subscriptions.insert(topic_str);
-                    // Also update the persistent subscriptions map
-                    client_subscriptions[clients[clientfd].id].insert(
-                        topic_str);
+            if (pfds[i].revents & POLLOUT) {
+                clients[pfds[i].fd].outbound.flush(pfds[i].fd, lanes.stats);
+            }
 
-                } else if (msg_subscription.header.type ==
-                           MSG_TYPE_UNSUBSCRIBE) {
-                    clients[clientfd].subscriptions.erase(topic_str);
-                    // Also update the persistent subscriptions map
-                    client_subscriptions[clients[clientfd].id].erase(topic_str);
+            if (pfds[i].revents & (POLLERR | POLLHUP)) {
+                handle_client_disconnect(pfds[i].fd, clients, client_ids,
+                                         client_subscriptions);
+                pfds[i].fd = -1;  // Mark the fd as closed
+                continue;
+            }
 
-                } else {
-                    // std::cerr << "Received unexpected message type from
-                    // client "
-                    //           << clients[clientfd].id << std::endl;
+            if (pfds[i].revents & POLLIN) {  // Incoming data from client
+                int clientfd = pfds[i].fd;
+                if (!handle_client_data(clientfd, clients[clientfd],
+                                        client_subscriptions)) {
                     handle_client_disconnect(clientfd, clients, client_ids,
                                              client_subscriptions);
-                    pfds[i].fd = -1;
+                    pfds[i].fd = -1;  // Mark the fd as closed
                     continue;
                 }
             }
         }
 
+        if (interest_dirty) {
+            update_peer_interest(federation, client_ids, client_subscriptions);
+        }
+
         // Clean up closed file descriptors from the poll array
         for (size_t i = pfds.size() - 1; i > 2; --i) {
             if (pfds[i].fd < 0) {
@@ -379,6 +1105,16 @@ int main(int argc, char* argv[]) {
     clients.clear();
     client_ids.clear();
 
+    if (capture.is_open()) {
+        capture.close();
+        // The capture cannot be replayed faithfully if anything is missing
+        if (capture.dropped() > 0 || capture.lost_bytes() > 0) {
+            std::cerr << "Capture incomplete: " << capture.dropped()
+                      << " records dropped, " << capture.lost_bytes()
+                      << " bytes lost to write errors." << std::endl;
+        }
+    }
+
     for (size_t i = 1; i < pfds.size(); ++i) {
         close(pfds[i].fd);
     }
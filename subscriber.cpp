@@ -3,59 +3,116 @@
 #include <poll.h>
 #include <string.h>
 #include <unistd.h>
+#include <fstream>
 #include <iostream>
 #include <sstream>
 #include <vector>
+#include "busy_poll.h"
 #include "common.h"
+#include "content_filter.h"
 #include "tcp_protocol.h"
 #include "utils.h"
 
-void handle_stdin(int sockfd_tcp) {
-    std::string line;
-    std::getline(std::cin, line);
-
+// Parse a "subscribe <TOPIC> [<OP> <VALUE>]" or "unsubscribe <TOPIC>" line
+bool parse_command(const std::string& line, SubscriptionCommand& out) {
     std::string command;
-    std::string topic;
-
     std::istringstream iss(line);
     iss >> command;
 
-    if (command == "exit") {
-        close(sockfd_tcp);
-        close(STDIN_FILENO);
-        exit(EXIT_SUCCESS);
+    if (command != "subscribe" && command != "unsubscribe") {
+        return false;
     }
+    out.type = (command == "subscribe" ? MSG_TYPE_SUBSCRIBE
+                                       : MSG_TYPE_UNSUBSCRIBE);
 
-    if (command == "subscribe" || command == "unsubscribe") {
-        iss >> topic;
-        if (topic.empty()) {
-            // std::cerr << "Topic is required for subscribe/unsubscribe
-            // command"
-            //           << std::endl;
-            return;
+    out.topic.clear();
+    iss >> out.topic;
+    if (out.topic.empty()) {
+        // std::cerr << "Topic is required for subscribe/unsubscribe command"
+        //           << std::endl;
+        return false;
+    }
+
+    // The rest of the line is an optional filter, e.g. "> 30"
+    out.filter.clear();
+    if (out.type == MSG_TYPE_SUBSCRIBE) {
+        std::getline(iss, out.filter);
+        ContentFilter compiled;
+        if (!compile_content_filter(out.filter, compiled)) {
+            std::cerr << "Invalid filter expression for topic " << out.topic
+                      << ":" << out.filter << std::endl;
+            return false;
         }
-        // command and topic already read: topic may already be in variable
-        // Prepare subscription or unsubscription message
-        MsgSubscription msg;
-        uint32_t total_len = sizeof(msg) + topic.size();
-        msg.header.len = htonl(total_len);
-        msg.header.type = (command == "subscribe" ? MSG_TYPE_SUBSCRIBE
-                                                  : MSG_TYPE_UNSUBSCRIBE);
-        msg.topic_len = htons(topic.size());
-        // Send header and topic_len
-        int send_status = send_all(sockfd_tcp, &msg, sizeof(msg));
-        DIE(send_status < 0, "Failed to send subscription message");
-        // Send topic string
-        send_status = send_all(sockfd_tcp, const_cast<char*>(topic.c_str()),
-                               topic.size());
+        if (compiled.op == FILTER_NONE) {
+            out.filter.clear();
+        }
+    }
+    return true;
+}
+
+// Read subscription commands from a file, one per line as on stdin
+bool load_subscriptions(const char* path,
+                        std::vector<SubscriptionCommand>& commands) {
+    std::ifstream file(path);
+    if (!file) {
+        return false;
+    }
+
+    std::string line;
+    SubscriptionCommand cmd;
+    while (std::getline(file, line)) {
+        if (parse_command(line, cmd)) {
+            commands.push_back(cmd);
+        }
+    }
+    return true;
+}
+
+void handle_stdin(int sockfd_tcp) {
+    std::vector<SubscriptionCommand> commands;
+    bool exit_requested = false;
+
+    // Lines that arrived together (pasted or piped) are sent in one write
+    do {
+        std::string line;
+        if (!std::getline(std::cin, line)) {
+            break;
+        }
+
+        std::string command;
+        std::istringstream iss(line);
+        iss >> command;
+        if (command == "exit") {
+            exit_requested = true;
+            break;
+        }
+
+        SubscriptionCommand cmd;
+        if (parse_command(line, cmd)) {
+            commands.push_back(cmd);
+        }
+    } while (std::cin.rdbuf()->in_avail() > 0);
+
+    if (!commands.empty()) {
+        std::vector<char> buffer = encode_subscriptions(commands);
+        int send_status = send_all(sockfd_tcp, buffer.data(), buffer.size());
         DIE(send_status < 0, "Failed to send subscription message");
 
-        if (command == "subscribe") {
-            std::cout << "Subscribed to topic " << topic << std::endl;
-        } else {
-            std::cout << "Unsubscribed from topic " << topic << std::endl;
+        for (const auto& cmd : commands) {
+            if (cmd.type == MSG_TYPE_SUBSCRIBE) {
+                std::cout << "Subscribed to topic " << cmd.topic << std::endl;
+            } else {
+                std::cout << "Unsubscribed from topic " << cmd.topic
+                          << std::endl;
+            }
         }
     }
+
+    if (exit_requested) {
+        close(sockfd_tcp);
+        close(STDIN_FILENO);
+        exit(EXIT_SUCCESS);
+    }
 }
 
 void handle_tcp(int sockfd_tcp) {
@@ -108,13 +165,36 @@ void handle_tcp(int sockfd_tcp) {
 
 int main(int argc, char* argv[]) {
     setvbuf(stdout, NULL, _IONBF, BUFSIZ);
+    // Let std::cin buffer input itself, so handle_stdin can tell whether
+    // more lines are already available
+    std::ios::sync_with_stdio(false);
 
-    if (argc != 4) {
+    if (argc < 4 || argc % 2 != 0) {
         // std::cerr << "Usage: " << argv[0] << " <client_id> <IP> <PORT>"
+        //           << " [--subscriptions <FILE>] [--busy-poll <CPU>]"
         //           << std::endl;
         exit(EXIT_FAILURE);
     }
 
+    const char* subscriptions_path = nullptr;
+    int busy_poll_cpu = -1;
+    for (int i = 4; i < argc; i += 2) {
+        if (strcmp(argv[i], "--subscriptions") == 0) {
+            subscriptions_path = argv[i + 1];
+        } else if (strcmp(argv[i], "--busy-poll") == 0) {
+            busy_poll_cpu = atoi(argv[i + 1]);
+            DIE(busy_poll_cpu < 0, "Given CPU is invalid");
+        } else {
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    std::vector<SubscriptionCommand> initial_commands;
+    if (subscriptions_path != nullptr) {
+        DIE(!load_subscriptions(subscriptions_path, initial_commands),
+            "Failed to read subscriptions file");
+    }
+
     char* client_id = argv[1];
     int id_len = strlen(client_id);
     if (id_len > 10) {
@@ -137,6 +217,14 @@ int main(int argc, char* argv[]) {
                             (char*)&enable, sizeof(int));
     DIE(result < 0, "setsockopt TCP_NODELAY failed");
 
+    bool busy_poll = busy_poll_cpu >= 0;
+    if (busy_poll) {
+        DIE(!pin_to_cpu(busy_poll_cpu), "sched_setaffinity failed");
+        enable_socket_busy_poll(sockfd_tcp);
+    }
+    AdaptivePoller poller(busy_poll);
+    poller.add_spin_socket(sockfd_tcp);
+
     struct sockaddr_in server_addr;
     memset(&server_addr, 0, sizeof(server_addr));
     server_addr.sin_family = AF_INET;
@@ -153,10 +241,23 @@ int main(int argc, char* argv[]) {
     msg_client_id.header.type = MSG_TYPE_CLIENT_ID;
     memset(msg_client_id.id, 0, sizeof(msg_client_id.id));
     memcpy(msg_client_id.id, client_id, id_len);
-    int send_status =
-        send_all(sockfd_tcp, &msg_client_id, sizeof(msg_client_id));
+
+    // The subscriptions file goes out in the same write as the client ID
+    std::vector<char> send_buf(sizeof(msg_client_id));
+    memcpy(send_buf.data(), &msg_client_id, sizeof(msg_client_id));
+    if (!initial_commands.empty()) {
+        std::vector<char> batch = encode_subscriptions(initial_commands);
+        send_buf.insert(send_buf.end(), batch.begin(), batch.end());
+    }
+    int send_status = send_all(sockfd_tcp, send_buf.data(), send_buf.size());
     DIE(send_status < 0, "Failed to send client ID");
 
+    if (!initial_commands.empty()) {
+        std::cout << "Loaded " << initial_commands.size()
+                  << " subscription commands from " << subscriptions_path
+                  << std::endl;
+    }
+
     struct pollfd fds[2];
 
     // STDIN
@@ -170,7 +271,7 @@ int main(int argc, char* argv[]) {
     fds[1].revents = 0;
 
     while (true) {
-        DIE(poll(fds, 2, -1) < 0, "poll failed");
+        DIE(poller.wait(fds, 2) < 0, "poll failed");
 
         if (fds[0].revents & POLLIN) {
             handle_stdin(sockfd_tcp);
@@ -1,5 +1,6 @@
 #include "tcp_protocol.h"
 #include <arpa/inet.h>
+#include <string.h>
 #include <iostream>
 #include "utils.h"
 
@@ -37,3 +38,131 @@ int send_all(int sockfd, void* buffer, size_t len) {
 
     return bytes_sent;
 }
+
+// Append the raw bytes of a packed protocol struct
+template <typename T>
+static void append_struct(std::vector<char>& buffer, const T& value) {
+    const char* ptr = reinterpret_cast<const char*>(&value);
+    buffer.insert(buffer.end(), ptr, ptr + sizeof(value));
+}
+
+// Append the topic and the filter that follow a subscription struct
+static void append_strings(std::vector<char>& buffer,
+                           const SubscriptionCommand& cmd) {
+    buffer.insert(buffer.end(), cmd.topic.begin(), cmd.topic.end());
+    buffer.insert(buffer.end(), cmd.filter.begin(), cmd.filter.end());
+}
+
+std::vector<char> encode_subscriptions(
+    const std::vector<SubscriptionCommand>& commands) {
+    std::vector<char> buffer;
+
+    if (commands.size() == 1) {
+        const SubscriptionCommand& cmd = commands[0];
+        MsgSubscription msg;
+        msg.header.type = cmd.type;
+        msg.topic_len = htons(cmd.topic.size());
+        msg.filter_len = htons(cmd.filter.size());
+        append_struct(buffer, msg);
+        append_strings(buffer, cmd);
+    } else {
+        MsgSubscriptionBatch batch;
+        batch.header.type = MSG_TYPE_SUBSCRIBE_BATCH;
+        batch.count = htonl(commands.size());
+        append_struct(buffer, batch);
+        for (const auto& cmd : commands) {
+            MsgSubscriptionEntry entry;
+            entry.type = cmd.type;
+            entry.topic_len = htons(cmd.topic.size());
+            entry.filter_len = htons(cmd.filter.size());
+            append_struct(buffer, entry);
+            append_strings(buffer, cmd);
+        }
+    }
+
+    // Both messages start with the header, its length is known only now
+    TcpHeader header;
+    memcpy(&header, buffer.data(), sizeof(header));
+    header.len = htonl(buffer.size());
+    memcpy(buffer.data(), &header, sizeof(header));
+    return buffer;
+}
+
+// Read the topic and the filter that follow a subscription struct
+static bool decode_strings(const char* message,
+                           size_t len,
+                           size_t& offset,
+                           uint16_t topic_len,
+                           uint16_t filter_len,
+                           SubscriptionCommand& cmd) {
+    if (len - offset < static_cast<size_t>(topic_len) + filter_len) {
+        return false;
+    }
+
+    cmd.topic.assign(message + offset, topic_len);
+    cmd.filter.assign(message + offset + topic_len, filter_len);
+    offset += topic_len + filter_len;
+    return true;
+}
+
+bool decode_subscriptions(const char* message,
+                          size_t len,
+                          std::vector<SubscriptionCommand>& commands) {
+    commands.clear();
+    TcpHeader header;
+    if (len < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, message, sizeof(header));
+    size_t offset;
+
+    if (header.type == MSG_TYPE_SUBSCRIBE ||
+        header.type == MSG_TYPE_UNSUBSCRIBE) {
+        MsgSubscription msg;
+        if (len < sizeof(msg)) {
+            return false;
+        }
+        memcpy(&msg, message, sizeof(msg));
+        offset = sizeof(msg);
+
+        SubscriptionCommand cmd;
+        cmd.type = header.type;
+        if (!decode_strings(message, len, offset, ntohs(msg.topic_len),
+                            ntohs(msg.filter_len), cmd)) {
+            return false;
+        }
+        commands.push_back(std::move(cmd));
+    } else if (header.type == MSG_TYPE_SUBSCRIBE_BATCH) {
+        MsgSubscriptionBatch batch;
+        if (len < sizeof(batch)) {
+            return false;
+        }
+        memcpy(&batch, message, sizeof(batch));
+        uint32_t count = ntohl(batch.count);
+        offset = sizeof(batch);
+
+        for (uint32_t i = 0; i < count; i++) {
+            MsgSubscriptionEntry entry;
+            if (len - offset < sizeof(entry)) {
+                return false;
+            }
+            memcpy(&entry, message + offset, sizeof(entry));
+            offset += sizeof(entry);
+
+            SubscriptionCommand cmd;
+            cmd.type = entry.type;
+            if ((entry.type != MSG_TYPE_SUBSCRIBE &&
+                 entry.type != MSG_TYPE_UNSUBSCRIBE) ||
+                !decode_strings(message, len, offset, ntohs(entry.topic_len),
+                                ntohs(entry.filter_len), cmd)) {
+                return false;
+            }
+            commands.push_back(std::move(cmd));
+        }
+    } else {
+        return false;
+    }
+
+    // Trailing bytes mean the lengths are corrupted
+    return offset == len;
+}
@@ -3,11 +3,21 @@
 #include <arpa/inet.h>
 #include <cstdint>
 #include <string>
+#include <vector>
 
 #define MSG_TYPE_CLIENT_ID 1
 #define MSG_TYPE_SUBSCRIBE 2
 #define MSG_TYPE_UNSUBSCRIBE 3
 #define MSG_TYPE_FORWARD_UDP 4
+#define MSG_TYPE_PEER_HELLO 5
+#define MSG_TYPE_PEER_INTEREST 6
+#define MSG_TYPE_PEER_FORWARD 7
+#define MSG_TYPE_SUBSCRIBE_BATCH 8
+
+// Upper bound for a message sent by a client, to reject corrupted lengths
+#define MAX_CLIENT_MESSAGE_LEN (16 * 1024 * 1024)
+// Bytes read from a client per wakeup, so one client cannot stall the others
+#define CLIENT_READ_CHUNK (64 * 1024)
 
 #pragma pack(push, 1)
 
@@ -25,8 +35,23 @@ struct MsgClientID {
 // Subscribe/Unsubscribe message
 struct MsgSubscription {
     TcpHeader header;    // type = MSG_TYPE_SUBSCRIBE or MSG_TYPE_UNSUBSCRIBE
-    uint16_t topic_len;  // Length of the topic string
-    // Topic string follows (variable length)
+    uint16_t topic_len;   // Length of the topic string
+    uint16_t filter_len;  // Length of the filter expression (0 = no filter)
+    // Topic string follows, then the filter expression (variable length)
+};
+
+// Many subscribe/unsubscribe commands, applied by the server as one update
+struct MsgSubscriptionBatch {
+    TcpHeader header;  // type = MSG_TYPE_SUBSCRIBE_BATCH
+    uint32_t count;    // Number of entries that follow
+};
+
+// Entry of a MsgSubscriptionBatch
+struct MsgSubscriptionEntry {
+    uint8_t type;         // MSG_TYPE_SUBSCRIBE or MSG_TYPE_UNSUBSCRIBE
+    uint16_t topic_len;   // Length of the topic string
+    uint16_t filter_len;  // Length of the filter expression (0 = no filter)
+    // Topic string follows, then the filter expression (variable length)
 };
 
 // UDP message forwarding structure
@@ -39,7 +64,43 @@ struct MsgUDPForward {
     uint16_t content_len;  // Length of the content
 };
 
+// Broker to broker messages. A peer introduces itself with a MsgClientID of
+// type MSG_TYPE_PEER_HELLO carrying its broker ID in decimal.
+//
+// A MSG_TYPE_PEER_INTEREST message is a TcpHeader followed by a list of
+// (uint16_t topic_len, topic string) entries; it replaces the previous list.
+
+// UDP message forwarded to a peer broker
+struct MsgPeerForward {
+    TcpHeader header;      // type = MSG_TYPE_PEER_FORWARD
+    uint32_t origin_id;    // ID of the broker that received the UDP message
+    uint32_t epoch;        // Changes every time the origin broker starts
+    uint32_t seq;          // Per-origin sequence number, restarts with epoch
+    uint32_t sender_ip;    // IP address in network byte order
+    uint16_t sender_port;  // Port in network byte order
+    uint16_t topic_len;    // Length of the topic string
+    uint8_t data_type;     // 0=INT, 1=SHORT_REAL, 2=FLOAT, 3=STRING
+    uint16_t content_len;  // Length of the content
+};
+
 #pragma pack(pop)
 
+// A subscribe or unsubscribe command, as carried by the subscription messages
+struct SubscriptionCommand {
+    uint8_t type;        // MSG_TYPE_SUBSCRIBE or MSG_TYPE_UNSUBSCRIBE
+    std::string topic;
+    std::string filter;  // Empty if there is no filter
+};
+
 int send_all(int sockfd, void* buffer, size_t len);
-int recv_all(int sockfd, void* buffer, size_t len);
\ No newline at end of file
+int recv_all(int sockfd, void* buffer, size_t len);
+
+// Encode commands as a single MsgSubscription, or as a MsgSubscriptionBatch
+// if there are several of them, so they always go out in one write
+std::vector<char> encode_subscriptions(
+    const std::vector<SubscriptionCommand>& commands);
+// Decode a whole subscription message, header included. Returns false if any
+// part of it is invalid, in which case none of it must be applied.
+bool decode_subscriptions(const char* message,
+                          size_t len,
+                          std::vector<SubscriptionCommand>& commands);
\ No newline at end of file
@@ -0,0 +1,237 @@
+"""Broker tests: several brokers and subscribers on localhost ports, covering
+federation and subscription batches.
+
+Run with `python3 test_federation.py` after `make`.
+"""
+
+import socket
+import struct
+import sys
+import tempfile
+import time
+from subprocess import Popen, PIPE, STDOUT
+
+ip = "127.0.0.1"
+base_port = 24600
+
+####### Process utils #######
+class Process:
+  """Server or subscriber, with its output collected in a temporary file."""
+
+  def __init__(self, command):
+    self.command = command
+    self.output = tempfile.TemporaryFile(mode="w+")
+    self.proc = Popen(command, stdin=PIPE, stdout=self.output, stderr=STDOUT,
+                      universal_newlines=True)
+    time.sleep(0.3)
+
+  def send_input(self, line):
+    self.proc.stdin.write(line + "\n")
+    self.proc.stdin.flush()
+
+  def get_output(self):
+    self.output.seek(0)
+    return self.output.read()
+
+  def finish(self):
+    if self.proc.poll() is None:
+      try:
+        self.send_input("exit")
+        self.proc.wait(timeout=2)
+      except Exception:
+        self.proc.kill()
+        self.proc.wait()
+
+def start_server(port, *args):
+  return Process(["./server", str(port)] + list(args))
+
+def start_subscriber(id, port, topics, *args):
+  sub = Process(["./subscriber", id, ip, str(port)] + list(args))
+  for topic in topics:
+    sub.send_input("subscribe " + topic)
+  return sub
+
+def publish(port, topic, value):
+  """Sends a STRING message to a broker, as the UDP clients do."""
+  payload = topic.encode().ljust(50, b"\0") + bytes([3]) + value.encode()
+  with socket.socket(socket.AF_INET, socket.SOCK_DGRAM) as s:
+    s.sendto(payload, (ip, port))
+
+def received_values(sub, topic):
+  values = []
+  for line in sub.get_output().splitlines():
+    parts = line.split(" - ")
+    if len(parts) == 4 and parts[1] == topic:
+      values.append(parts[3])
+  return values
+
+def peer_stats(server):
+  """Returns [(broker_id, forwarded, received, duplicates)], one per link."""
+  server.send_input("stats")
+  time.sleep(0.2)
+  stats = []
+  for line in server.get_output().splitlines():
+    if line.startswith("Peer ") and ": forwarded " in line:
+      peer, counters = line[len("Peer "):].split(": ", 1)
+      numbers = [int(word.strip(",")) for word in counters.split()[1::2]]
+      stats.append((peer,) + tuple(numbers))
+  return stats
+
+####### Tests #######
+def test_interest_routing():
+  """Only topics a peer has interest in are forwarded to it."""
+  a = start_server(base_port, "--id", "1")
+  b = start_server(base_port + 1, "--id", "2", "--peer", "%s:%d" % (ip, base_port))
+  s = start_subscriber("S1", base_port + 1, ["fed/wanted"])
+  procs = [s, b, a]
+  try:
+    time.sleep(0.5)
+    for i in range(5):
+      publish(base_port, "fed/wanted", "w%d" % i)
+      publish(base_port, "fed/other", "o%d" % i)
+    time.sleep(0.5)
+
+    ok = received_values(s, "fed/wanted") == ["w%d" % i for i in range(5)]
+    ok = ok and received_values(s, "fed/other") == []
+    # Nothing but the wanted topic crossed the link
+    ok = ok and peer_stats(a) == [("2", 5, 0, 0)]
+    return ok
+  finally:
+    for p in procs:
+      p.finish()
+
+def test_double_link_duplicates():
+  """Two links between the same brokers deliver every message once."""
+  a = start_server(base_port + 2, "--id", "1",
+                   "--peer", "%s:%d" % (ip, base_port + 3))
+  b = start_server(base_port + 3, "--id", "2",
+                   "--peer", "%s:%d" % (ip, base_port + 2))
+  procs = [b, a]
+  try:
+    # a dials b again after its first attempt failed
+    time.sleep(1.0)
+    s = start_subscriber("S2", base_port + 3, ["fed/+"])
+    procs.insert(0, s)
+    time.sleep(0.5)
+    for i in range(10):
+      publish(base_port + 2, "fed/dup", "d%d" % i)
+    time.sleep(0.5)
+
+    ok = received_values(s, "fed/dup") == ["d%d" % i for i in range(10)]
+    # Both links carried every message, one copy of each was dropped
+    stats = peer_stats(b)
+    ok = ok and len(stats) == 2
+    ok = ok and sum(counters[2] for counters in stats) == 20
+    ok = ok and sum(counters[3] for counters in stats) == 10
+    return ok
+  finally:
+    for p in procs:
+      p.finish()
+
+def test_peer_restart():
+  """A restarted origin broker is reconnected and its messages delivered."""
+  a = start_server(base_port + 4, "--id", "1",
+                   "--peer", "%s:%d" % (ip, base_port + 5))
+  s = start_subscriber("S3", base_port + 4, ["fed/*"])
+  b = start_server(base_port + 5, "--id", "2")
+  procs = [s, a]
+  try:
+    time.sleep(1.0)
+    for i in range(10):
+      publish(base_port + 5, "fed/restart", "first%d" % i)
+    time.sleep(0.5)
+    b.finish()
+
+    # Same ID, sequence numbers start over
+    b = start_server(base_port + 5, "--id", "2")
+    time.sleep(1.5)
+    for i in range(15):
+      publish(base_port + 5, "fed/restart", "second%d" % i)
+    time.sleep(0.5)
+
+    expected = ["first%d" % i for i in range(10)]
+    expected += ["second%d" % i for i in range(15)]
+    return received_values(s, "fed/restart") == expected
+  finally:
+    b.finish()
+    for p in procs:
+      p.finish()
+
+def test_subscriptions_file():
+  """A subscriptions file is applied as one batch, in order."""
+  server = start_server(base_port + 6)
+  commands = tempfile.NamedTemporaryFile(mode="w", suffix=".txt")
+  for i in range(500):
+    commands.write("subscribe batch/t%d\n" % i)
+  commands.write("subscribe batch/f == \"on\"\n")
+  commands.write("unsubscribe batch/t7\n")
+  commands.flush()
+  s = start_subscriber("S4", base_port + 6, [], "--subscriptions",
+                       commands.name)
+  procs = [s, server]
+  try:
+    time.sleep(0.3)
+    publish(base_port + 6, "batch/t499", "last")
+    publish(base_port + 6, "batch/t7", "removed")
+    publish(base_port + 6, "batch/f", "off")
+    publish(base_port + 6, "batch/f", "on")
+    time.sleep(0.3)
+
+    ok = "Loaded 502 subscription commands" in s.get_output()
+    ok = ok and received_values(s, "batch/t499") == ["last"]
+    ok = ok and received_values(s, "batch/t7") == []
+    ok = ok and received_values(s, "batch/f") == ["on"]
+    return ok
+  finally:
+    for p in procs:
+      p.finish()
+    commands.close()
+
+def test_stalled_client():
+  """A client stalled in the middle of a message does not delay the others."""
+  server = start_server(base_port + 7)
+  raw = socket.create_connection((ip, base_port + 7))
+  procs = [server]
+  try:
+    raw.sendall(struct.pack("!IB", 16, 1) + b"RAW".ljust(11, b"\0"))
+    topic = b"stall/raw"
+    batch = struct.pack("!IBI", 0, 8, 1)
+    batch += struct.pack("!BHH", 2, len(topic), 0) + topic
+    batch = struct.pack("!I", len(batch)) + batch[4:]
+    raw.sendall(batch[:7])
+    time.sleep(0.2)
+
+    s = start_subscriber("S5", base_port + 7, ["stall/other"])
+    procs.insert(0, s)
+    time.sleep(0.2)
+    publish(base_port + 7, "stall/other", "served")
+    time.sleep(0.3)
+    ok = received_values(s, "stall/other") == ["served"]
+
+    # The rest of the message completes the subscription
+    raw.sendall(batch[7:])
+    time.sleep(0.2)
+    publish(base_port + 7, "stall/raw", "late")
+    raw.settimeout(2)
+    ok = ok and b"late" in raw.recv(4096)
+    return ok
+  except socket.timeout:
+    return False
+  finally:
+    raw.close()
+    for p in procs:
+      p.finish()
+
+def main():
+  tests = [test_interest_routing, test_double_link_duplicates,
+           test_peer_restart, test_subscriptions_file, test_stalled_client]
+  failed = 0
+  for test in tests:
+    passed = test()
+    failed += 0 if passed else 1
+    name = test.__name__
+    print(name + "." * (60 - len(name) - 6) + ("passed" if passed else "failed"))
+  sys.exit(1 if failed else 0)
+
+if __name__ == "__main__":
+  main()
@@ -0,0 +1,498 @@
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "capture.h"
+#include "common.h"
+#include "content_filter.h"
+#include "federation.h"
+#include "outbound.h"
+#include "tcp_protocol.h"
+
+// Unit checks for the pure helpers, run with `make check`
+
+static int failures = 0;
+
+#define CHECK(condition)                                              \
+    do {                                                              \
+        if (!(condition)) {                                           \
+            std::cerr << __FILE__ << ":" << __LINE__                  \
+                      << ": check failed: " #condition << std::endl;  \
+            failures++;                                               \
+        }                                                             \
+    } while (0)
+
+// Raw content of each data type, as sent by the UDP clients
+static std::vector<char> int_content(long long value) {
+    std::vector<char> content(5);
+    content[0] = value < 0 ? 1 : 0;
+    uint32_t abs_net = htonl(static_cast<uint32_t>(value < 0 ? -value : value));
+    memcpy(content.data() + 1, &abs_net, sizeof(abs_net));
+    return content;
+}
+
+static std::vector<char> short_real_content(uint16_t hundredths) {
+    std::vector<char> content(2);
+    uint16_t num_net = htons(hundredths);
+    memcpy(content.data(), &num_net, sizeof(num_net));
+    return content;
+}
+
+static std::vector<char> float_content(bool negative,
+                                       uint32_t digits,
+                                       uint8_t power_neg) {
+    std::vector<char> content(6);
+    content[0] = negative ? 1 : 0;
+    uint32_t digits_net = htonl(digits);
+    memcpy(content.data() + 1, &digits_net, sizeof(digits_net));
+    content[5] = static_cast<char>(power_neg);
+    return content;
+}
+
+static std::vector<char> string_content(const std::string& value) {
+    std::vector<char> content(value.begin(), value.end());
+    content.push_back('\0');
+    return content;
+}
+
+// Compile `expr` and evaluate it against a message of the given type
+static bool matches(const std::string& expr,
+                    uint8_t data_type,
+                    const std::vector<char>& content) {
+    ContentFilter filter;
+    if (!compile_content_filter(expr, filter)) {
+        std::cerr << "failed to compile \"" << expr << "\"" << std::endl;
+        failures++;
+        return false;
+    }
+
+    UdpValue value;
+    if (!decode_udp_value(data_type, content.data(), content.size(), value)) {
+        std::cerr << "failed to decode type " << int(data_type) << std::endl;
+        failures++;
+        return false;
+    }
+    return filter_matches(filter, value);
+}
+
+static void test_content_filter() {
+    ContentFilter filter;
+
+    // Compilation
+    CHECK(compile_content_filter("", filter) && filter.op == FILTER_NONE);
+    CHECK(compile_content_filter("  ", filter) && filter.op == FILTER_NONE);
+    CHECK(compile_content_filter("> 30", filter) && filter.op == FILTER_GT &&
+          filter.numeric && filter.number == 30);
+    CHECK(compile_content_filter(">=-1.5", filter) && filter.op == FILTER_GE &&
+          filter.numeric && filter.number == -1.5);
+    CHECK(compile_content_filter("== on", filter) && filter.op == FILTER_EQ &&
+          !filter.numeric && filter.str == "on");
+    CHECK(compile_content_filter("== \"42\"", filter) && !filter.numeric &&
+          filter.str == "42");
+    CHECK(compile_content_filter("!= \"two words\"", filter) &&
+          filter.op == FILTER_NE && filter.str == "two words");
+
+    // Malformed expressions
+    CHECK(!compile_content_filter("30", filter));
+    CHECK(!compile_content_filter("junk", filter));
+    CHECK(!compile_content_filter(">", filter));
+    CHECK(!compile_content_filter("=> 3", filter));
+
+    // INT
+    CHECK(matches("== 10", 0, int_content(10)));
+    CHECK(!matches("== 10", 0, int_content(-10)));
+    CHECK(matches("!= 0", 0, int_content(-10)));
+    CHECK(!matches("!= 0", 0, int_content(0)));
+    CHECK(matches("< 0", 0, int_content(-10)));
+    CHECK(!matches("< -10", 0, int_content(-10)));
+    CHECK(matches("<= -10", 0, int_content(-10)));
+    CHECK(matches("> 1234567889", 0, int_content(1234567890)));
+    CHECK(!matches("> 5", 0, int_content(5)));
+    CHECK(matches(">= 5", 0, int_content(5)));
+
+    // SHORT_REAL
+    CHECK(matches("== 2.3", 1, short_real_content(230)));
+    CHECK(matches("!= 2.31", 1, short_real_content(230)));
+    CHECK(matches("< 2.5", 1, short_real_content(230)));
+    CHECK(!matches("< 2.5", 1, short_real_content(65505)));
+    CHECK(matches("<= 655.05", 1, short_real_content(65505)));
+    CHECK(matches("> 655", 1, short_real_content(65505)));
+    CHECK(!matches(">= 17.01", 1, short_real_content(1700)));
+
+    // FLOAT
+    CHECK(matches("== 17", 2, float_content(false, 17, 0)));
+    CHECK(matches("== -17", 2, float_content(true, 17, 0)));
+    CHECK(matches("!= 17", 2, float_content(true, 17, 0)));
+    CHECK(matches("< -1.2", 2, float_content(true, 12345, 4)));
+    CHECK(matches("<= 1.2345", 2, float_content(false, 12345, 4)));
+    CHECK(matches("> 30", 2, float_content(false, 305, 1)));
+    CHECK(!matches(">= 30.6", 2, float_content(false, 305, 1)));
+
+    // STRING, unquoted and quoted operands
+    CHECK(matches("== open", 3, string_content("open")));
+    CHECK(matches("== \"open\"", 3, string_content("open")));
+    CHECK(!matches("== open", 3, string_content("opened")));
+    CHECK(matches("!= open", 3, string_content("opened")));
+    CHECK(matches("< b", 3, string_content("abc")));
+    CHECK(matches("<= abc", 3, string_content("abc")));
+    CHECK(matches("> ab", 3, string_content("abc")));
+    CHECK(!matches(">= abd", 3, string_content("abc")));
+    CHECK(matches("== \"10\"", 3, string_content("10")));
+
+    // Type mismatch: numeric operands never match STRING and vice versa
+    CHECK(!matches("== 10", 3, string_content("10")));
+    CHECK(!matches("!= 10", 3, string_content("10")));
+    CHECK(!matches("!= open", 0, int_content(10)));
+    CHECK(!matches("== \"10\"", 0, int_content(10)));
+
+    // No filter matches everything
+    CHECK(matches("", 3, string_content("anything")));
+    CHECK(matches("", 0, int_content(-1)));
+}
+
+static void test_duplicate_filter() {
+    DuplicateFilter duplicates;
+
+    // In order, then repeated
+    CHECK(!duplicates.seen(1, 100, 1));
+    CHECK(!duplicates.seen(1, 100, 2));
+    CHECK(duplicates.seen(1, 100, 1));
+    CHECK(duplicates.seen(1, 100, 2));
+
+    // Out of order within the window
+    CHECK(!duplicates.seen(1, 100, 5));
+    CHECK(!duplicates.seen(1, 100, 4));
+    CHECK(duplicates.seen(1, 100, 4));
+    CHECK(!duplicates.seen(1, 100, 3));
+
+    // Origins are independent
+    CHECK(!duplicates.seen(2, 100, 1));
+    CHECK(duplicates.seen(2, 100, 1));
+
+    // Sliding past the window
+    CHECK(!duplicates.seen(1, 100, 200));
+    CHECK(duplicates.seen(1, 100, 200 - 64));
+    CHECK(!duplicates.seen(1, 100, 200 - 63));
+    CHECK(duplicates.seen(1, 100, 200 - 63));
+
+    // A restarted origin (new epoch) counts from 1 again
+    CHECK(!duplicates.seen(1, 101, 1));
+    CHECK(!duplicates.seen(1, 101, 2));
+    CHECK(duplicates.seen(1, 101, 1));
+}
+
+static void test_interest_encoding() {
+    std::set<std::string> decoded;
+
+    std::set<std::string> empty;
+    std::vector<char> body = encode_interest(empty);
+    CHECK(body.empty());
+    CHECK(decode_interest(body.data(), body.size(), decoded));
+    CHECK(decoded.empty());
+
+    std::set<std::string> interest = {"UPB/+/temperature", "a", "*",
+                                      std::string(300, 'x')};
+    body = encode_interest(interest);
+    CHECK(decode_interest(body.data(), body.size(), decoded));
+    CHECK(decoded == interest);
+
+    // Truncated bodies are rejected
+    CHECK(!decode_interest(body.data(), body.size() - 1, decoded));
+    CHECK(!decode_interest(body.data(), 1, decoded));
+}
+
+static void test_outbound_limit() {
+    const size_t chunk = OUTBOUND_QUEUE_LIMIT / 4;
+    auto message = [chunk](char tag) {
+        return std::make_shared<const std::vector<char>>(chunk, tag);
+    };
+
+    LaneStats stats[NUM_LANES];
+    OutboundQueue queue;
+    queue.push(0, message('a'), stats);
+    queue.push(2, message('b'), stats);
+    queue.push(2, message('c'), stats);
+    queue.push(1, message('d'), stats);
+    CHECK(queue.bytes() == OUTBOUND_QUEUE_LIMIT);
+    CHECK(stats[2].dropped == 0);
+
+    // The oldest message of the lowest lane goes first
+    queue.push(0, message('e'), stats);
+    CHECK(queue.bytes() == OUTBOUND_QUEUE_LIMIT);
+    CHECK(stats[2].dropped == 1);
+
+    queue.push(0, message('f'), stats);
+    queue.push(0, message('g'), stats);
+    CHECK(stats[2].dropped == 2);
+    CHECK(stats[1].dropped == 1);
+    CHECK(stats[0].dropped == 0);
+
+    // Only lane 0 is left, in order: a e f g
+    int fds[2];
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    std::string received;
+    std::vector<char> buff(chunk);
+    while (!queue.empty()) {
+        CHECK(queue.flush(fds[0], stats));
+        ssize_t rc;
+        while ((rc = recv(fds[1], buff.data(), buff.size(), MSG_DONTWAIT)) >
+               0) {
+            for (ssize_t i = 0; i < rc; i++) {
+                if (received.empty() || received.back() != buff[i]) {
+                    received += buff[i];
+                }
+            }
+        }
+    }
+    CHECK(received == "aefg");
+    CHECK(queue.bytes() == 0);
+    CHECK(stats[0].count == 4);
+
+    // A partially sent message is kept even in the lowest lane
+    LaneStats partial_stats[NUM_LANES];
+    OutboundQueue partial;
+    partial.push(2, message('h'), partial_stats);
+    CHECK(partial.flush(fds[0], partial_stats));
+    CHECK(!partial.empty());
+    for (int i = 0; i < 4; i++) {
+        partial.push(0, message('i'), partial_stats);
+    }
+    CHECK(partial_stats[2].dropped == 0);
+    CHECK(partial_stats[0].dropped == 1);
+
+    // Control messages are kept, the droppable ones behind them go first
+    LaneStats control_stats[NUM_LANES];
+    OutboundQueue control;
+    control.push(2, message('j'), control_stats, false);
+    control.push(2, message('k'), control_stats);
+    for (int i = 0; i < 3; i++) {
+        control.push(0, message('l'), control_stats, false);
+    }
+    CHECK(control_stats[2].dropped == 1);
+    control.push(0, message('m'), control_stats);
+    CHECK(control_stats[0].dropped == 1);
+    CHECK(control.bytes() == OUTBOUND_QUEUE_LIMIT);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+static void test_outbound_order() {
+    auto message = [](char tag) {
+        return std::make_shared<const std::vector<char>>(1, tag);
+    };
+    int fds[2];
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    auto drain = [&fds](OutboundQueue& queue, LaneStats* stats) {
+        CHECK(queue.flush(fds[0], stats));
+        CHECK(queue.empty());
+        char buff[64];
+        ssize_t rc = recv(fds[1], buff, sizeof(buff), MSG_DONTWAIT);
+        return std::string(buff, rc > 0 ? rc : 0);
+    };
+
+    // Lane 0 drains first, each lane in FIFO order
+    LaneStats stats[NUM_LANES];
+    OutboundQueue queue;
+    queue.push(2, message('a'), stats);
+    queue.push(1, message('b'), stats);
+    queue.push(2, message('c'), stats);
+    queue.push(0, message('d'), stats);
+    queue.push(0, message('e'), stats);
+    CHECK(drain(queue, stats) == "debac");
+    CHECK(stats[0].count == 2 && stats[1].count == 1 && stats[2].count == 2);
+
+    // A waiting lane sends one message after LANE_STARVATION_LIMIT sends
+    // from the higher lanes
+    queue.push(2, message('y'), stats);
+    queue.push(2, message('z'), stats);
+    for (int i = 0; i < LANE_STARVATION_LIMIT + 2; i++) {
+        queue.push(0, message('x'), stats);
+    }
+    CHECK(drain(queue, stats) ==
+          std::string(LANE_STARVATION_LIMIT, 'x') + "yxxz");
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+static void test_capture_round_trip() {
+    char path[] = "/tmp/test_capture_XXXXXX";
+    int fd = mkstemp(path);
+    CHECK(fd >= 0);
+    close(fd);
+
+    struct sockaddr_in sender1 = {};
+    sender1.sin_addr.s_addr = inet_addr("10.0.0.1");
+    sender1.sin_port = htons(1234);
+    struct sockaddr_in sender2 = {};
+    sender2.sin_addr.s_addr = inet_addr("10.0.0.2");
+    sender2.sin_port = htons(5678);
+    std::string first = "first datagram";
+    std::string second(1500, 'x');
+    std::string empty;
+
+    CaptureWriter writer;
+    CHECK(writer.open(path));
+    writer.record(first.data(), first.size(), sender1);
+    writer.record(second.data(), second.size(), sender2);
+    writer.record(empty.data(), empty.size(), sender1);
+    writer.close();
+    CHECK(writer.recorded() == 3);
+    CHECK(writer.dropped() == 0);
+    CHECK(writer.lost_bytes() == 0);
+
+    CaptureRecord record;
+    const char* data;
+    {
+        CaptureReader reader;
+        CHECK(reader.open(path));
+        CHECK(reader.next(record, data));
+        CHECK(std::string(data, record.len) == first);
+        CHECK(record.sender_ip == sender1.sin_addr.s_addr);
+        CHECK(record.sender_port == sender1.sin_port);
+        uint64_t first_ns = record.timestamp_ns;
+
+        CHECK(reader.next(record, data));
+        CHECK(std::string(data, record.len) == second);
+        CHECK(record.sender_ip == sender2.sin_addr.s_addr);
+        CHECK(record.sender_port == sender2.sin_port);
+        CHECK(record.timestamp_ns >= first_ns);
+
+        CHECK(reader.next(record, data));
+        CHECK(record.len == 0);
+        CHECK(!reader.next(record, data));
+    }
+
+    // A truncated record ends the capture before it
+    CHECK(truncate(path, sizeof(CaptureFileHeader) + 2 * sizeof(record) +
+                             first.size() + second.size() - 1) == 0);
+    {
+        CaptureReader reader;
+        CHECK(reader.open(path));
+        CHECK(reader.next(record, data));
+        CHECK(std::string(data, record.len) == first);
+        CHECK(!reader.next(record, data));
+    }
+
+    // So does a truncated record header
+    CHECK(truncate(path, sizeof(CaptureFileHeader) + sizeof(record) +
+                             first.size() + sizeof(record) - 1) == 0);
+    {
+        CaptureReader reader;
+        CHECK(reader.open(path));
+        CHECK(reader.next(record, data));
+        CHECK(!reader.next(record, data));
+    }
+
+    // Files that are not captures are rejected
+    fd = open(path, O_WRONLY | O_TRUNC);
+    CHECK(fd >= 0);
+    CaptureFileHeader header;
+    memcpy(header.magic, "NOTACAPT", sizeof(header.magic));
+    header.version = CAPTURE_VERSION;
+    CHECK(write(fd, &header, sizeof(header)) ==
+          static_cast<ssize_t>(sizeof(header)));
+    close(fd);
+    {
+        CaptureReader reader;
+        CHECK(!reader.open(path));
+    }
+
+    CHECK(truncate(path, sizeof(header) - 1) == 0);
+    {
+        CaptureReader reader;
+        CHECK(!reader.open(path));
+    }
+
+    unlink(path);
+}
+
+static bool same_commands(const std::vector<SubscriptionCommand>& a,
+                          const std::vector<SubscriptionCommand>& b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); i++) {
+        if (a[i].type != b[i].type || a[i].topic != b[i].topic ||
+            a[i].filter != b[i].filter) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void test_subscription_encoding() {
+    std::vector<SubscriptionCommand> decoded;
+
+    // A single command is a plain MsgSubscription
+    std::vector<SubscriptionCommand> single = {
+        {MSG_TYPE_SUBSCRIBE, "UPB/+/temperature", "> 30"}};
+    std::vector<char> message = encode_subscriptions(single);
+    TcpHeader header;
+    memcpy(&header, message.data(), sizeof(header));
+    CHECK(header.type == MSG_TYPE_SUBSCRIBE);
+    CHECK(ntohl(header.len) == message.size());
+    CHECK(decode_subscriptions(message.data(), message.size(), decoded));
+    CHECK(same_commands(decoded, single));
+
+    std::vector<SubscriptionCommand> batch = {
+        {MSG_TYPE_SUBSCRIBE, "a/b", ""},
+        {MSG_TYPE_SUBSCRIBE, "c/*", "== \"on\""},
+        {MSG_TYPE_UNSUBSCRIBE, "a/b", ""},
+        {MSG_TYPE_SUBSCRIBE, std::string(1000, 't'), "<= -1.5"}};
+    message = encode_subscriptions(batch);
+    memcpy(&header, message.data(), sizeof(header));
+    CHECK(header.type == MSG_TYPE_SUBSCRIBE_BATCH);
+    CHECK(ntohl(header.len) == message.size());
+    CHECK(decode_subscriptions(message.data(), message.size(), decoded));
+    CHECK(same_commands(decoded, batch));
+
+    // Truncated messages and trailing bytes are rejected
+    for (size_t len = 0; len < message.size(); len++) {
+        CHECK(!decode_subscriptions(message.data(), len, decoded));
+    }
+    std::vector<char> trailing = message;
+    trailing.push_back('x');
+    CHECK(!decode_subscriptions(trailing.data(), trailing.size(), decoded));
+
+    // An invalid entry rejects the whole batch, even after valid ones
+    std::vector<char> bad_entry = message;
+    size_t second_entry = sizeof(MsgSubscriptionBatch) +
+                          sizeof(MsgSubscriptionEntry) + batch[0].topic.size();
+    bad_entry[second_entry] = MSG_TYPE_CLIENT_ID;
+    CHECK(!decode_subscriptions(bad_entry.data(), bad_entry.size(), decoded));
+
+    // So do a wrong message type and an entry count that does not match
+    std::vector<char> bad_type = message;
+    bad_type[offsetof(TcpHeader, type)] = MSG_TYPE_FORWARD_UDP;
+    CHECK(!decode_subscriptions(bad_type.data(), bad_type.size(), decoded));
+
+    std::vector<char> bad_count = message;
+    uint32_t count = htonl(batch.size() + 1);
+    memcpy(bad_count.data() + offsetof(MsgSubscriptionBatch, count), &count,
+           sizeof(count));
+    CHECK(!decode_subscriptions(bad_count.data(), bad_count.size(), decoded));
+}
+
+int main() {
+    test_content_filter();
+    test_duplicate_filter();
+    test_interest_encoding();
+    test_outbound_limit();
+    test_outbound_order();
+    test_capture_round_trip();
+    test_subscription_encoding();
+
+    if (failures > 0) {
+        std::cerr << failures << " check(s) failed" << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::cout << "All unit checks passed." << std::endl;
+    return 0;
+}